@@ -0,0 +1,37 @@
+/* linux/drivers/video/fbdev/vpoutfb/elv-mipi-dsi-api.h
+ *
+ * Elvees MIPI-DSI Controller: interface for the video output driver.
+ *
+ */
+
+#ifndef _ELV_MIPI_DSI_API_H
+#define _ELV_MIPI_DSI_API_H
+
+#include <linux/types.h>
+
+struct elv_mipi_dsi;
+
+/*
+ * Обновление framebuffer: возвращает полную частоту кадров и продлевает
+ * таймеры простоя и autosuspend. Может вызываться из атомарного контекста.
+ */
+void elv_mipi_dsi_frame_activity(struct elv_mipi_dsi *dsi);
+
+/*
+ * Событие кадра из прерывания VSYNC видеовыхода (в видеорежиме контроллер
+ * DSI прерывания по кадру не формирует). Может вызываться из атомарного
+ * контекста.
+ */
+void elv_mipi_dsi_vblank(struct elv_mipi_dsi *dsi);
+
+/* Ожидание следующего события кадра: 0, -ETIMEDOUT или -ERESTARTSYS */
+int elv_mipi_dsi_wait_vblank(struct elv_mipi_dsi *dsi, unsigned int timeout_ms);
+
+/*
+ * Командный режим (elvees,command-mode): передача прямоугольной области
+ * fb в GRAM панели, fb в формате pixel-format линка. Может спать.
+ */
+int elv_mipi_dsi_update_region(struct elv_mipi_dsi *dsi, const void *fb,
+			       u32 pitch, u32 x, u32 y, u32 w, u32 h);
+
+#endif /* _ELV_MIPI_DSI_API_H */
@@ -0,0 +1,44 @@
+/* linux/drivers/video/fbdev/vpoutfb/elv-mipi-dsi-trace.h
+ *
+ * Elvees MIPI-DSI Controller trace events.
+ *
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM elv_mipi_dsi
+
+#if !defined(_ELV_MIPI_DSI_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _ELV_MIPI_DSI_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(elv_dsi_frame,
+
+	TP_PROTO(u32 frame, u32 bytes, u32 util),
+
+	TP_ARGS(frame, bytes, util),
+
+	TP_STRUCT__entry(
+		__field(u32, frame)
+		__field(u32, bytes)
+		__field(u32, util)
+	),
+
+	TP_fast_assign(
+		__entry->frame = frame;
+		__entry->bytes = bytes;
+		__entry->util = util;
+	),
+
+	TP_printk("frame=%u bytes=%u util=%u.%u%%",
+		  __entry->frame, __entry->bytes,
+		  __entry->util / 10, __entry->util % 10)
+);
+
+#endif /* _ELV_MIPI_DSI_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE elv-mipi-dsi-trace
+#include <trace/define_trace.h>
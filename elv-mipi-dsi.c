@@ -11,10 +11,13 @@
 #include <linux/clk-provider.h>
 #include <linux/platform_device.h>
 #include <linux/of_gpio.h>
+#include <linux/gpio/consumer.h>
 #include <linux/of.h>
 #include <linux/spi/spi.h>
 #include <linux/of_device.h>
 #include <linux/io.h>
+#include <linux/iopoll.h>
+#include <linux/ktime.h>
 #include <linux/sysfs.h>
 #include <linux/irq.h>
 #include <linux/memory.h>
@@ -23,48 +26,576 @@
 #include <linux/kthread.h>
 #include <linux/err.h>
 #include <linux/pm.h>
-
+#include <linux/pm_runtime.h>
+#include <linux/regmap.h>
+#include <linux/math64.h>
+#include <linux/mutex.h>
+#include <linux/completion.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+
+#include <drm/drm_mipi_dsi.h>
+#include <video/mipi_display.h>
+#include <video/of_display_timing.h>
+#include <video/videomode.h>
 #include <video/elv_mipi_dsi.h>
 #include "elv-mipi-dsi.h"
+#include "elv-mipi-dsi-api.h"
+
+#define CREATE_TRACE_POINTS
+#include "elv-mipi-dsi-trace.h"
 
 #ifdef CONFIG_DEBUG_FS
 #include <linux/debugfs.h>
 #endif
 
-/*#ifdef	CONFIG_PM
-static int dsi_autosuspend_delay = 15;		// Default delay value, in seconds 
+#ifdef	CONFIG_PM
+/*
+ * В видеорежиме кадры идут непрерывно, и ULPS гасит панель. Autosuspend
+ * включается только вместе с драйвером видеовыхода, который сообщает о
+ * кадрах через elv_mipi_dsi_frame_activity(); отрицательное значение
+ * запрещает runtime suspend.
+ */
+static int dsi_autosuspend_delay = -1;		// Default delay value, in seconds 
 module_param_named(autosuspend, dsi_autosuspend_delay, int, 0644);
-MODULE_PARM_DESC(autosuspend, "default dsi autosuspend delay");
+MODULE_PARM_DESC(autosuspend, "default dsi autosuspend delay, <0 disables");
 
 #else
 #define dsi_autosuspend_delay		0
-#endif*/
+#endif
+
+/*
+ * Поле режима линий в DSI_DEVICE_READY_REG. Это запрос драйвера, а не
+ * состояние линий: регистра состояния линий у контроллера нет, поэтому
+ * переходы выдерживаются по времени. Вход в ULPS - escape-последовательность
+ * из десятка бит LP (единицы мкс), выход - T_WAKEUP.
+ */
+#define DSI_DEVICE_MODE_MASK		(DEVICE_ULP_MODE | DEVICE_EXIT_MODE | DEVICE_NORMAL_MODE)
+#define DSI_ULPS_ENTER_US		100
+#define DSI_ULPS_WAKEUP_US		1000	/* T_WAKEUP >= 1 мс, D-PHY 1.0 п. 6.6 */
+
+/* Остановка линии тактирования в гашении (non-continuous clock) */
+#define DSI_CLK_EOT_CLOCKSTOP		BIT(1)
+
+/* Биты DSI_IRQ_STATUS_REG/DSI_IRQ_ENABLE_REG */
+#define DSI_INT_RX_SOT_ERR		BIT(0)
+#define DSI_INT_RX_SOT_SYNC_ERR		BIT(1)
+#define DSI_INT_RX_EOT_SYNC_ERR		BIT(2)
+#define DSI_INT_RX_ESC_ENTRY_ERR	BIT(3)
+#define DSI_INT_RX_LPTX_SYNC_ERR	BIT(4)
+#define DSI_INT_RX_PERIPH_TIMEOUT	BIT(5)
+#define DSI_INT_RX_FALSE_CTRL_ERR	BIT(6)
+#define DSI_INT_RX_ECC_SINGLE		BIT(7)
+#define DSI_INT_RX_ECC_MULTI		BIT(8)
+#define DSI_INT_RX_CRC_ERR		BIT(9)
+#define DSI_INT_RX_DT_UNKNOWN		BIT(10)
+#define DSI_INT_RX_VC_INVALID		BIT(11)
+#define DSI_INT_TX_FALSE_CTRL_ERR	BIT(12)
+#define DSI_INT_TX_ECC_SINGLE		BIT(13)
+#define DSI_INT_TX_ECC_MULTI		BIT(14)
+#define DSI_INT_TX_CRC_ERR		BIT(15)
+#define DSI_INT_TX_DT_UNKNOWN		BIT(16)
+#define DSI_INT_TX_VC_INVALID		BIT(17)
+#define DSI_INT_HIGH_CONTENTION		BIT(18)
+#define DSI_INT_LOW_CONTENTION		BIT(19)
+#define DSI_INT_DPI_FIFO_UNDERRUN	BIT(20)
+#define DSI_INT_HS_TX_TIMEOUT		BIT(21)
+#define DSI_INT_LP_RX_TIMEOUT		BIT(22)
+#define DSI_INT_TA_ACK_TIMEOUT		BIT(23)
+#define DSI_INT_RX_INVALID_LEN		BIT(25)
+#define DSI_INT_RX_PROT_VIOLATION	BIT(26)
+#define DSI_INT_GEN_READ_DATA		BIT(29)
+
+#define DSI_INT_ERRORS			(GENMASK(23, 0) | DSI_INT_RX_INVALID_LEN | \
+					 DSI_INT_RX_PROT_VIOLATION)
+/* Ошибки, после которых линк сам не восстанавливается */
+#define DSI_INT_FATAL			(DSI_INT_HIGH_CONTENTION | DSI_INT_LOW_CONTENTION | \
+					 DSI_INT_DPI_FIFO_UNDERRUN | DSI_INT_HS_TX_TIMEOUT | \
+					 DSI_INT_TX_FALSE_CTRL_ERR | INT_OUTFIFO)
+#define DSI_RECOVER_INTERVAL_MS		1000
+
+/* Ошибки пакетов, по которым оценивается качество линка */
+#define DSI_INT_LINK_ERRORS		(DSI_INT_RX_SOT_ERR | DSI_INT_RX_SOT_SYNC_ERR | \
+					 DSI_INT_RX_EOT_SYNC_ERR | DSI_INT_RX_ECC_SINGLE | \
+					 DSI_INT_RX_ECC_MULTI | DSI_INT_RX_CRC_ERR | \
+					 DSI_INT_TX_ECC_SINGLE | DSI_INT_TX_ECC_MULTI | \
+					 DSI_INT_TX_CRC_ERR)
+#define DSI_LINK_LEVELS			4	/* уровень 0 - номинальные тайминги */
+#define DSI_LINK_MARGIN_PCT		25	/* удлинение интервалов D-PHY на уровень */
+#define DSI_LINK_CLEAN_INTERVALS	10	/* интервалов без ошибок до шага назад */
+
+/*
+ * FIFO команд (generic/DCS пакеты). В общем заголовке регистров нет,
+ * они следуют сразу за DSI_LP_BYTECLK_REG в той же раскладке, что и
+ * остальная карта контроллера. Регистр управления принимает заголовок
+ * пакета целиком: DI в битах 7:0, data0/data1 или WC в битах 23:8.
+ */
+#define DSI_LP_GEN_DATA_REG		(DSI_LP_BYTECLK_REG + 0x04)
+#define DSI_HS_GEN_DATA_REG		(DSI_LP_BYTECLK_REG + 0x08)
+#define DSI_LP_GEN_CTRL_REG		(DSI_LP_BYTECLK_REG + 0x0c)
+#define DSI_HS_GEN_CTRL_REG		(DSI_LP_BYTECLK_REG + 0x10)
+#define DSI_GEN_FIFO_STAT_REG		(DSI_LP_BYTECLK_REG + 0x14)
+
+#define DSI_FIFO_HS_DATA_FULL		BIT(0)
+#define DSI_FIFO_HS_DATA_EMPTY		BIT(2)
+#define DSI_FIFO_LP_DATA_FULL		BIT(8)
+#define DSI_FIFO_LP_DATA_EMPTY		BIT(10)
+#define DSI_FIFO_HS_CTRL_FULL		BIT(16)
+#define DSI_FIFO_HS_CTRL_EMPTY		BIT(18)
+#define DSI_FIFO_LP_CTRL_FULL		BIT(24)
+#define DSI_FIFO_LP_CTRL_EMPTY		BIT(26)
+#define DSI_CMD_TIMEOUT_US		20000
+#define DSI_BTA_TIMEOUT_US		200	/* ответ периферии после BTA */
+#define DSI_READ_TIMEOUT_MS		20
+#define DSI_CMD_MAX_PAYLOAD		240	/* байт пикселей в одном пакете memory write */
+#define DSI_TE_TIMEOUT_MS		50
+#define DSI_READ_DONE			(DSI_INT_GEN_READ_DATA | DSI_INT_TA_ACK_TIMEOUT | \
+					 DSI_INT_LP_RX_TIMEOUT)
+
+/* Последовательности, для которых считается число обращений к шине */
+enum {
+	DSI_SEQ_INIT,
+	DSI_SEQ_REPROGRAM,
+	DSI_SEQ_RESTORE,
+	DSI_SEQ_ULPS_ENTER,
+	DSI_SEQ_ULPS_EXIT,
+	DSI_SEQ_NR,
+};
+
+static const char * const elv_dsi_seq_names[DSI_SEQ_NR] = {
+	[DSI_SEQ_INIT] = "init",
+	[DSI_SEQ_REPROGRAM] = "reprogram",
+	[DSI_SEQ_RESTORE] = "restore",
+	[DSI_SEQ_ULPS_ENTER] = "ulps enter",
+	[DSI_SEQ_ULPS_EXIT] = "ulps exit",
+};
+
+struct elv_dsi_cost {
+	u32 reads;
+	u32 writes;
+};
+
+/* Поля регистра DSI_FUNC_PRG_REG */
+#define DSI_FUNC_PRG_LANES(n)		((n) & 0x7)
+#define DSI_FUNC_PRG_VM_CHAN(vc)	(((vc) & 0x3) << 3)
+#define DSI_FUNC_PRG_VM_FMT(f)		(((f) & 0x7) << 7)
+#define DSI_FUNC_PRG_CM_CHAN(vc)	(((vc) & 0x3) << 5)
+#define DSI_FUNC_PRG_CM_WIDTH_8BIT	(3 << 13)	/* команды и пиксели - байтами */
+
+struct elv_dsi_format {
+	const char *name;
+	int video_format;	/* DSI_video_format_* */
+	u32 func_prg_fmt;
+	u8 dcs_fmt;		/* set_pixel_format панели в командном режиме */
+};
+
+static const struct elv_dsi_format elv_dsi_formats[] = {
+	{ "rgb565",		DSI_video_format_RGB565,	DSI_FUNC_PRG_VM_FMT(1),
+	  MIPI_DCS_PIXEL_FMT_16BIT },
+	{ "rgb666",		DSI_video_format_RGB666,	DSI_FUNC_PRG_VM_FMT(2),
+	  MIPI_DCS_PIXEL_FMT_18BIT },
+	{ "rgb666-loose",	DSI_video_format_RGB666_lp,	DSI_FUNC_PRG_VM_FMT(3),
+	  MIPI_DCS_PIXEL_FMT_18BIT },
+	{ "rgb888",		DSI_video_format_RGB888,	DSI_FUNC_PRG_VM_FMT(4),
+	  MIPI_DCS_PIXEL_FMT_24BIT },
+};
+
+static const char * const elv_dsi_irq_names[32] = {
+	[0] = "rx_sot",			[1] = "rx_sot_sync",
+	[2] = "rx_eot_sync",		[3] = "rx_escape_entry",
+	[4] = "rx_lptx_sync",		[5] = "rx_periph_timeout",
+	[6] = "rx_false_control",	[7] = "rx_ecc_single",
+	[8] = "rx_ecc_multi",		[9] = "rx_crc",
+	[10] = "rx_dt_unknown",		[11] = "rx_vc_invalid",
+	[12] = "tx_false_control",	[13] = "tx_ecc_single",
+	[14] = "tx_ecc_multi",		[15] = "tx_crc",
+	[16] = "tx_dt_unknown",		[17] = "tx_vc_invalid",
+	[18] = "high_contention",	[19] = "low_contention",
+	[20] = "dpi_fifo_underrun",	[21] = "hs_tx_timeout",
+	[22] = "lp_rx_timeout",		[23] = "ta_ack_timeout",
+	[25] = "rx_invalid_length",	[26] = "rx_protocol_violation",
+	[29] = "read_data_avail",
+};
+
+/*
+ * Режим по умолчанию, если в DT нет display-timings: 480x800,
+ * значения porch/sync совпадают с командой SETDISP в panel-hx8369a-spi.c
+ */
+static const struct videomode elv_dsi_default_vm = {
+	.hactive = 480,
+	.hfront_porch = 12,
+	.hback_porch = 12,
+	.hsync_len = 12,
+	.vactive = 800,
+	.vfront_porch = 6,
+	.vback_porch = 6,
+	.vsync_len = 6,
+};
+
+/*
+ * Контекст контроллера для восстановления после снятия питания домена.
+ * Сначала PLL, затем конфигурация линка; DEVICE_READY в контекст не входит,
+ * линк запускается отдельно после восстановления. Эти же регистры
+ * кэширует regmap.
+ */
+static const u32 elv_dsi_ctx_regs[] = {
+	DSI_TRIM0_REG, DSI_TRIM1_REG, DSI_TRIM2_REG, DSI_TRIM3_REG,
+	DSI_PLL_LOCK_COUNT_REG,
+	DSI_FUNC_PRG_REG, DSI_VIDEO_MODE_FORMAT_REG, DSI_CLK_EOT_REG,
+	DSI_POLARITY_REG, DSI_DATA_LANE_POLARITY_SWAP_REG,
+	DSI_HS_TX_TIMEOUT_REG, DSI_LP_RX_TIMEOUT_REG, DSI_TURN_AROUND_TIMEOUT_REG,
+	DSI_DEVICE_RESET_REG, DSI_INIT_COUNT_REG, DSI_MAX_RETURN_PACKET_REG,
+	DSI_DPI_RESOLUTION_REG, DSI_HSYNC_COUNT_REG, DSI_HORIZ_BACK_PORCH_COUNT_REG,
+	DSI_HORIZ_FRONT_PORCH_COUNT_REG, DSI_HORIZ_ACTIVE_AREA_COUNT_REG,
+	DSI_VSYNC_COUNT_REG, DSI_VERT_BACK_PORCH_COUNT_REG,
+	DSI_VERT_FRONT_PORCH_COUNT_REG,
+	DSI_DPHY_PARAM_REG, DSI_CLK_LANE_TIMING_PARAM_REG, DSI_LP_BYTECLK_REG,
+	DSI_HIGH_LOW_SWITCH_COUNT_REG, DSI_CLK_LANE_SWT_REG,
+	DSI_AUTO_ERR_REC_REG, DSI_IRQ_ENABLE_REG,
+};
+
+/* Регистры состояния, команд и FIFO: мимо кэша regmap */
+static const u32 elv_dsi_volatile_regs[] = {
+	DSI_DEVICE_READY_REG, DSI_IRQ_STATUS_REG, DSI_DPI_CONTROL_REG,
+	DSI_RST_ENABLE_DFE_REG, DSI_DIR_DPI_DIFF_REG,
+	DSI_LP_GEN_DATA_REG, DSI_HS_GEN_DATA_REG, DSI_LP_GEN_CTRL_REG,
+	DSI_HS_GEN_CTRL_REG, DSI_GEN_FIFO_STAT_REG,
+};
+
+/*
+ * Тайминги DSI, рассчитанные в целых числах без потери точности.
+ * Периоды хранятся в пикосекундах, а пересчёт "пиксели -> такты byteclk"
+ * делается как точное отношение частот в 64-битной арифметике, поэтому
+ * усечение t_pclk и t_byteclk до целых наносекунд больше не влияет на результат.
+ */
+struct elv_dsi_timings {
+	u32 pclk_khz;
+	u32 ddr_mhz;
+	u32 t_pclk_ps;
+	u32 t_byteclk_ps;
+	u32 bpp;
+	u32 lanes;
+	bool clk_noncont;	/* линия тактирования уходит в LP в гашении */
+	u32 margin_pct;		/* удлинение интервалов D-PHY, % */
+
+	/* горизонтальные интервалы в тактах byteclk */
+	u32 hsync;
+	u32 hbp;
+	u32 hfp;
+	u32 haa;
+
+	/* параметры D-PHY в тактах byteclk */
+	u32 dln_hs_prep;
+	u32 dln_hs_zero;
+	u32 dln_hs_trail;
+	u32 dln_hs_exit;
+	u32 cln_prep;
+	u32 cln_zero;
+	u32 cln_hs_trail;
+	u32 cln_hs_exit;
+	u32 lp_byteclk;
+	u32 high_ls_count;
+	u32 hs_to_lp;
+	u32 lp_to_hs;
+	u32 ta_timeout;
+
+	/* выбранная рабочая точка PLL */
+	u32 div_ratio;
+	u32 req_khz;		/* минимально необходимая ddr_clk для режима */
+	u32 lp_window;		/* запас строки под переходы HS<->LP, такты byteclk */
+};
+
+#ifdef CONFIG_DEBUG_FS
+#define DSI_ACCESS_LOG_SIZE		256
+
+struct elv_dsi_access {
+	u16 reg;
+	bool write;
+	u32 val;
+};
+#endif
+
+/*
+ * Состояние драйвера, не входящее в struct elv_mipi_dsi: сама структура
+ * объявлена в общем заголовке, поэтому расширяем её обёрткой.
+ */
+struct elv_mipi_dsi_priv {
+	struct elv_mipi_dsi dsi;
+	struct elv_dsi_timings timings;
+	bool burst_mode;
+	bool clk_noncont;
+	
+	u32 lanes;
+	const struct elv_dsi_format *format;
+	struct display_timings *disp;	/* все режимы из DT */
+	struct videomode vm;			/* текущий режим */
+	u32 timing;						/* его номер в disp */
+	u32 reconfigs;					/* смены режима через sysfs mode */
+	u32 reconfig_us;
+	
+	struct mutex lock;				/* перепрограммирование линка */
+	struct clk *pclk;				/* pixclk видеовыхода, необязательный */
+	u32 refresh;					/* текущая частота кадров, Гц */
+	u32 refresh_max;				/* частота кадров режима из DT */
+	u32 idle_refresh;
+	u32 idle_timeout_ms;
+	unsigned long last_activity;
+	struct delayed_work idle_work;
+	struct work_struct wake_work;
+	
+	u32 ulps_enter_us;				/* последние измеренные задержки ULPS */
+	u32 ulps_exit_us;
+	
+	/* dphy_clk выключен, пока линк в ULPS или остановлен */
+	bool dphy_gated;
+	ktime_t dphy_gate_stamp;
+	u64 dphy_off_us;
+	u32 dphy_gates;
+	
+	/* runtime PM: время в активном и приостановленном состоянии */
+	bool rpm_ulps;					/* ULPS включён runtime suspend */
+	ktime_t rpm_stamp;
+	u64 rpm_active_us;
+	u64 rpm_suspended_us;
+	u32 rpm_suspends;
+	
+	/* счётчики прерываний по битам DSI_IRQ_STATUS_REG и восстановление */
+	atomic_t irq_count[32];		/* из прерывания и работ, поэтому atomic */
+	u32 recoveries;
+	u32 recover_skipped;
+	unsigned long recover_last;
+	struct delayed_work recover_work;
+	
+	/* адаптация линка к ошибкам: уровень запаса таймингов D-PHY */
+	u32 link_interval_ms;
+	u32 link_threshold;				/* ошибок за интервал до шага вверх */
+	u32 link_level;
+	u32 link_clean;					/* интервалов подряд без ошибок */
+	u32 link_errors_last;
+	u32 link_rate;					/* ошибок за последний интервал */
+	u32 link_steps_up;
+	u32 link_steps_down;
+	struct delayed_work link_work;
+	
+	struct mipi_dsi_host host;		/* отправка команд панели по DSI */
+	struct mipi_dsi_device *devices[4];	/* по одному на виртуальный канал */
+	u32 video_vc;					/* виртуальный канал видеопотока */
+	struct completion read_done;	/* ответ на запрос чтения после BTA */
+	u32 read_status;
+	
+	/* командный режим: панель обновляется из своей GRAM по областям */
+	bool cmd_mode;
+	struct gpio_desc *te_gpio;
+	struct completion te_done;
+	u8 *cmd_buf;
+	u8 cmd_dcs_fmt;					/* set_pixel_format, переданный панели */
+	u32 cmd_updates;
+	u64 cmd_bytes;
+	u32 te_timeouts;
+	
+	/* события кадра: счётчик и время последнего vblank/TE */
+	spinlock_t vblank_lock;
+	u32 vblank_count;
+	ktime_t vblank_ts;
+	wait_queue_head_t vblank_wait;
+	struct kernfs_node *vblank_kn;	/* для poll() на sysfs vblank */
+	
+	/* сохранённые регистры, см. elv_dsi_ctx_regs */
+	u32 ctx[ARRAY_SIZE(elv_dsi_ctx_regs)];
+	bool ctx_valid;
+	u32 ctx_restores;
+	u32 ctx_restore_us;
+	
+	/* доступ к регистрам через regmap с плоским кэшем */
+	struct regmap *map;
+	atomic_t mmio_reads;		/* счётчики шины: обращения и из прерывания */
+	atomic_t mmio_writes;
+	atomic_t cache_reads;
+	atomic_t writes_skipped;
+	struct elv_dsi_cost seq_cost[DSI_SEQ_NR];	/* обращения к шине по DSI_SEQ_* */
+#ifdef CONFIG_DEBUG_FS
+	/* журнал обращений к шине, см. debugfs access_log */
+	spinlock_t log_lock;
+	bool log_enabled;
+	u32 log_head;
+	u32 log_count;
+	struct elv_dsi_access log[DSI_ACCESS_LOG_SIZE];
+#endif
+};
+
+static inline struct elv_mipi_dsi_priv *to_dsi_priv(struct elv_mipi_dsi *dsi)
+{
+	return container_of(dsi, struct elv_mipi_dsi_priv, dsi);
+}
+
+static bool dsi_reg_in(const u32 *regs, size_t n, unsigned int reg)
+{
+	size_t i;
+	
+	for (i = 0; i < n; i++)
+		if (regs[i] == reg)
+			return true;
+	return false;
+}
+
+static bool dsi_volatile_reg(struct device *dev, unsigned int reg)
+{
+	return dsi_reg_in(elv_dsi_volatile_regs, ARRAY_SIZE(elv_dsi_volatile_regs), reg);
+}
+
+static bool dsi_known_reg(struct device *dev, unsigned int reg)
+{
+	return dsi_volatile_reg(dev, reg) ||
+	       dsi_reg_in(elv_dsi_ctx_regs, ARRAY_SIZE(elv_dsi_ctx_regs), reg);
+}
+
+/* Чтение FIFO данных команд извлекает слово, regmap не должен его читать сам */
+static bool dsi_precious_reg(struct device *dev, unsigned int reg)
+{
+	return reg == DSI_LP_GEN_DATA_REG || reg == DSI_HS_GEN_DATA_REG;
+}
+
+#ifdef CONFIG_DEBUG_FS
+static void dsi_log_access(struct elv_mipi_dsi_priv *priv, unsigned int reg,
+			   unsigned int val, bool write)
+{
+	struct elv_dsi_access *a;
+	unsigned long flags;
+	
+	if (!READ_ONCE(priv->log_enabled))
+		return;
+	
+	spin_lock_irqsave(&priv->log_lock, flags);
+	a = &priv->log[priv->log_head];
+	a->reg = reg;
+	a->val = val;
+	a->write = write;
+	priv->log_head = (priv->log_head + 1) % DSI_ACCESS_LOG_SIZE;
+	if (priv->log_count < DSI_ACCESS_LOG_SIZE)
+		priv->log_count++;
+	spin_unlock_irqrestore(&priv->log_lock, flags);
+}
+#else
+static inline void dsi_log_access(struct elv_mipi_dsi_priv *priv, unsigned int reg,
+				  unsigned int val, bool write)
+{
+}
+#endif
+
+/*
+ * Единственный путь к MMIO, считаются все обращения к шине. Опрос
+ * FIFO команд через readl_poll_timeout() идёт мимо и не учитывается.
+ */
+static int dsi_regmap_read(void *context, unsigned int reg, unsigned int *val)
+{
+	struct elv_mipi_dsi_priv *priv = context;
+	
+	*val = ioread32(priv->dsi.reg_base + reg);
+	atomic_inc(&priv->mmio_reads);
+	dsi_log_access(priv, reg, *val, false);
+	return 0;
+}
+
+static int dsi_regmap_write(void *context, unsigned int reg, unsigned int val)
+{
+	struct elv_mipi_dsi_priv *priv = context;
+	
+	iowrite32(val, priv->dsi.reg_base + reg);
+	atomic_inc(&priv->mmio_writes);
+	dsi_log_access(priv, reg, val, true);
+	return 0;
+}
+
+/* Число обращений к шине за одну последовательность DSI_SEQ_* */
+static inline struct elv_dsi_cost dsi_seq_start(struct elv_mipi_dsi_priv *priv)
+{
+	struct elv_dsi_cost start = {
+		atomic_read(&priv->mmio_reads), atomic_read(&priv->mmio_writes)
+	};
+	
+	return start;
+}
+
+static inline void dsi_seq_end(struct elv_mipi_dsi_priv *priv, int seq,
+			       struct elv_dsi_cost start)
+{
+	priv->seq_cost[seq].reads = atomic_read(&priv->mmio_reads) - start.reads;
+	priv->seq_cost[seq].writes = atomic_read(&priv->mmio_writes) - start.writes;
+}
 
+/* Запись значения, уже находящегося в кэше, на шину не выходит */
 static inline void dsi_write(struct elv_mipi_dsi *dsi, u32 reg, u32 val)
 {
-	iowrite32(val, dsi->reg_base + reg);
+	struct elv_mipi_dsi_priv *priv = to_dsi_priv(dsi);
+	bool changed;
+	
+	if (dsi_volatile_reg(NULL, reg)) {
+		regmap_write(priv->map, reg, val);
+		return;
+	}
+	
+	regmap_update_bits_check(priv->map, reg, ~0U, val, &changed);
+	if (!changed)
+		atomic_inc(&priv->writes_skipped);
 }
 
 static inline u32 dsi_read(struct elv_mipi_dsi *dsi, u32 reg)
 {
-	return ioread32(dsi->reg_base + reg);
+	struct elv_mipi_dsi_priv *priv = to_dsi_priv(dsi);
+	unsigned int val = 0;
+	
+	if (!dsi_volatile_reg(NULL, reg))
+		atomic_inc(&priv->cache_reads);
+	regmap_read(priv->map, reg, &val);
+	return val;
+}
+
+/* Чтение из регистра в обход кэша */
+static inline u32 dsi_read_hw(struct elv_mipi_dsi *dsi, u32 reg)
+{
+	unsigned int val;
+	
+	dsi_regmap_read(to_dsi_priv(dsi), reg, &val);
+	return val;
 }
 
 static inline void dsi_modify(struct elv_mipi_dsi *dsi, u32 reg,
 			      u32 mask, u32 val)
 {
-	u32 v;
-
-	v = ioread32(dsi->reg_base + reg);
-	v &= ~mask;
-	v |= val;
-	iowrite32(v, dsi->reg_base + reg);
+	regmap_update_bits(to_dsi_priv(dsi)->map, reg, mask, val);
 }
 
 static int dsi_max(int x, int y) {
   return (x) >= (y) ? (x) : (y);
 }
 
+/*
+ * Объём кадра на линии в байтах: длинные пакеты активных строк
+ * (заголовок 4 байта + CRC 2 байта + пиксели) и короткие пакеты
+ * синхронизации (по 4 байта) на каждой строке, включая VSS/VSE.
+ */
+static u32 dsi_frame_bytes(struct elv_mipi_dsi_priv *priv)
+{
+	const struct videomode *vm = &priv->vm;
+	u32 vtotal = vm->vactive + vm->vfront_porch + vm->vback_porch + vm->vsync_len;
+	u32 sync = priv->burst_mode ? 4 : 8;	/* HSS, либо HSS + HSE */
+	
+	return vm->vactive * (6 + DIV_ROUND_UP(vm->hactive * priv->timings.bpp, 8)) +
+	       vtotal * sync;
+}
+
+/* Загрузка линка при текущей частоте кадров, в десятых долях процента */
+static u32 dsi_link_util(struct elv_mipi_dsi_priv *priv)
+{
+	u64 capacity = (u64)priv->timings.ddr_mhz * 2000000 * priv->timings.lanes;
+	
+	if (!capacity)
+		return 0;
+	return div64_u64((u64)dsi_frame_bytes(priv) * 8 * priv->refresh * 1000,
+			 capacity);
+}
+
 
 #ifdef CONFIG_DEBUG_FS
 #define DSI_REGS_BUFSIZE	2048
@@ -80,82 +611,88 @@ static ssize_t dsi_show_regs(struct file *file, char __user *user_buf,
 	if (!buf)
 		return 0;
 
+	pm_runtime_get_sync(dsi->dev);
+	/* Регистры читаются с шины, а в ручном ULPS dphy_clk выключен */
+	clk_prepare_enable(dsi->dphy_clk);
+
 	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
 			"%s registers:\n", dev_name(dsi->dev));
 	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
 			"=================================\n");
 	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
-			"DSI_DEVICE_READY_REG: \t\t\t0x%02x 0x%08x\n", DSI_DEVICE_READY_REG, dsi_read(dsi, DSI_DEVICE_READY_REG));
+			"DSI_DEVICE_READY_REG: \t\t\t0x%02x 0x%08x\n", DSI_DEVICE_READY_REG, dsi_read_hw(dsi, DSI_DEVICE_READY_REG));
 	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
-			"DSI_IRQ_STATUS_REG: \t\t\t0x%02x 0x%08x\n", DSI_IRQ_STATUS_REG, dsi_read(dsi, DSI_IRQ_STATUS_REG));
+			"DSI_IRQ_STATUS_REG: \t\t\t0x%02x 0x%08x\n", DSI_IRQ_STATUS_REG, dsi_read_hw(dsi, DSI_IRQ_STATUS_REG));
 	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
-			"DSI_IRQ_ENABLE_REG: \t\t\t0x%02x 0x%08x\n", DSI_IRQ_ENABLE_REG, dsi_read(dsi, DSI_IRQ_ENABLE_REG));
+			"DSI_IRQ_ENABLE_REG: \t\t\t0x%02x 0x%08x\n", DSI_IRQ_ENABLE_REG, dsi_read_hw(dsi, DSI_IRQ_ENABLE_REG));
 	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
-			"DSI_FUNC_PRG_REG: \t\t\t0x%02x 0x%08x\n", DSI_FUNC_PRG_REG, dsi_read(dsi, DSI_FUNC_PRG_REG));
+			"DSI_FUNC_PRG_REG: \t\t\t0x%02x 0x%08x\n", DSI_FUNC_PRG_REG, dsi_read_hw(dsi, DSI_FUNC_PRG_REG));
 	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
-			"DSI_HS_TX_TIMEOUT_REG: \t\t\t0x%02x 0x%08x\n", DSI_HS_TX_TIMEOUT_REG, dsi_read(dsi, DSI_HS_TX_TIMEOUT_REG));
+			"DSI_HS_TX_TIMEOUT_REG: \t\t\t0x%02x 0x%08x\n", DSI_HS_TX_TIMEOUT_REG, dsi_read_hw(dsi, DSI_HS_TX_TIMEOUT_REG));
 	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
-			"DSI_LP_RX_TIMEOUT_REG: \t\t\t0x%02x 0x%08x\n", DSI_LP_RX_TIMEOUT_REG, dsi_read(dsi, DSI_LP_RX_TIMEOUT_REG));
+			"DSI_LP_RX_TIMEOUT_REG: \t\t\t0x%02x 0x%08x\n", DSI_LP_RX_TIMEOUT_REG, dsi_read_hw(dsi, DSI_LP_RX_TIMEOUT_REG));
 	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,		
-			"DSI_TURN_AROUND_TIMEOUT_REG: \t\t0x%02x 0x%08x\n", DSI_TURN_AROUND_TIMEOUT_REG, dsi_read(dsi, DSI_TURN_AROUND_TIMEOUT_REG));
+			"DSI_TURN_AROUND_TIMEOUT_REG: \t\t0x%02x 0x%08x\n", DSI_TURN_AROUND_TIMEOUT_REG, dsi_read_hw(dsi, DSI_TURN_AROUND_TIMEOUT_REG));
 	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
-			"DSI_DPI_RESOLUTION_REG: \t\t0x%02x 0x%08x\n", DSI_DPI_RESOLUTION_REG, dsi_read(dsi, DSI_DPI_RESOLUTION_REG));
+			"DSI_DPI_RESOLUTION_REG: \t\t0x%02x 0x%08x\n", DSI_DPI_RESOLUTION_REG, dsi_read_hw(dsi, DSI_DPI_RESOLUTION_REG));
 	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
-			"DSI_HSYNC_COUNT_REG: \t\t\t0x%02x 0x%08x\n", DSI_HSYNC_COUNT_REG, dsi_read(dsi, DSI_HSYNC_COUNT_REG));
+			"DSI_HSYNC_COUNT_REG: \t\t\t0x%02x 0x%08x\n", DSI_HSYNC_COUNT_REG, dsi_read_hw(dsi, DSI_HSYNC_COUNT_REG));
 	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
-			"DSI_HORIZ_BACK_PORCH_COUNT_REG: \t0x%02x 0x%08x\n", DSI_HORIZ_BACK_PORCH_COUNT_REG, dsi_read(dsi, DSI_HORIZ_BACK_PORCH_COUNT_REG));
+			"DSI_HORIZ_BACK_PORCH_COUNT_REG: \t0x%02x 0x%08x\n", DSI_HORIZ_BACK_PORCH_COUNT_REG, dsi_read_hw(dsi, DSI_HORIZ_BACK_PORCH_COUNT_REG));
 	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
-			"DSI_HORIZ_FRONT_PORCH_COUNT_REG: \t0x%02x 0x%08x\n", DSI_HORIZ_FRONT_PORCH_COUNT_REG, dsi_read(dsi, DSI_HORIZ_FRONT_PORCH_COUNT_REG));
+			"DSI_HORIZ_FRONT_PORCH_COUNT_REG: \t0x%02x 0x%08x\n", DSI_HORIZ_FRONT_PORCH_COUNT_REG, dsi_read_hw(dsi, DSI_HORIZ_FRONT_PORCH_COUNT_REG));
 	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
-			"DSI_HORIZ_ACTIVE_AREA_COUNT_REG: \t0x%02x 0x%08x\n", DSI_HORIZ_ACTIVE_AREA_COUNT_REG, dsi_read(dsi, DSI_HORIZ_ACTIVE_AREA_COUNT_REG));
+			"DSI_HORIZ_ACTIVE_AREA_COUNT_REG: \t0x%02x 0x%08x\n", DSI_HORIZ_ACTIVE_AREA_COUNT_REG, dsi_read_hw(dsi, DSI_HORIZ_ACTIVE_AREA_COUNT_REG));
 	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
-			"DSI_VSYNC_COUNT_REG: \t\t\t0x%02x 0x%08x\n", DSI_VSYNC_COUNT_REG, dsi_read(dsi, DSI_VSYNC_COUNT_REG));
+			"DSI_VSYNC_COUNT_REG: \t\t\t0x%02x 0x%08x\n", DSI_VSYNC_COUNT_REG, dsi_read_hw(dsi, DSI_VSYNC_COUNT_REG));
 	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
-			"DSI_VERT_BACK_PORCH_COUNT_REG: \t\t0x%02x 0x%08x\n", DSI_VERT_BACK_PORCH_COUNT_REG, dsi_read(dsi, DSI_VERT_BACK_PORCH_COUNT_REG));
+			"DSI_VERT_BACK_PORCH_COUNT_REG: \t\t0x%02x 0x%08x\n", DSI_VERT_BACK_PORCH_COUNT_REG, dsi_read_hw(dsi, DSI_VERT_BACK_PORCH_COUNT_REG));
 	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
-			"DSI_VERT_FRONT_PORCH_COUNT_REG: \t0x%02x 0x%08x\n", DSI_VERT_FRONT_PORCH_COUNT_REG, dsi_read(dsi, DSI_VERT_FRONT_PORCH_COUNT_REG));
+			"DSI_VERT_FRONT_PORCH_COUNT_REG: \t0x%02x 0x%08x\n", DSI_VERT_FRONT_PORCH_COUNT_REG, dsi_read_hw(dsi, DSI_VERT_FRONT_PORCH_COUNT_REG));
 	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
-			"DSI_HIGH_LOW_SWITCH_COUNT_REG: \t\t0x%02x 0x%08x\n", DSI_HIGH_LOW_SWITCH_COUNT_REG, dsi_read(dsi, DSI_HIGH_LOW_SWITCH_COUNT_REG));
+			"DSI_HIGH_LOW_SWITCH_COUNT_REG: \t\t0x%02x 0x%08x\n", DSI_HIGH_LOW_SWITCH_COUNT_REG, dsi_read_hw(dsi, DSI_HIGH_LOW_SWITCH_COUNT_REG));
 	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,	
-			"DSI_DPI_CONTROL_REG: \t\t\t0x%02x 0x%08x\n", DSI_DPI_CONTROL_REG, dsi_read(dsi, DSI_DPI_CONTROL_REG));
+			"DSI_DPI_CONTROL_REG: \t\t\t0x%02x 0x%08x\n", DSI_DPI_CONTROL_REG, dsi_read_hw(dsi, DSI_DPI_CONTROL_REG));
 	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
-			"DSI_PLL_LOCK_COUNT_REG: \t\t0x%02x 0x%08x\n", DSI_PLL_LOCK_COUNT_REG, dsi_read(dsi, DSI_PLL_LOCK_COUNT_REG));			
+			"DSI_PLL_LOCK_COUNT_REG: \t\t0x%02x 0x%08x\n", DSI_PLL_LOCK_COUNT_REG, dsi_read_hw(dsi, DSI_PLL_LOCK_COUNT_REG));			
 	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,	
-			"DSI_INIT_COUNT_REG: \t\t\t0x%02x 0x%08x\n", DSI_INIT_COUNT_REG, dsi_read(dsi, DSI_INIT_COUNT_REG));
+			"DSI_INIT_COUNT_REG: \t\t\t0x%02x 0x%08x\n", DSI_INIT_COUNT_REG, dsi_read_hw(dsi, DSI_INIT_COUNT_REG));
 	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
-			"DSI_MAX_RETURN_PACKET_REG: \t\t0x%02x 0x%08x\n", DSI_MAX_RETURN_PACKET_REG, dsi_read(dsi, DSI_MAX_RETURN_PACKET_REG));	
+			"DSI_MAX_RETURN_PACKET_REG: \t\t0x%02x 0x%08x\n", DSI_MAX_RETURN_PACKET_REG, dsi_read_hw(dsi, DSI_MAX_RETURN_PACKET_REG));	
 	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,	
-			"DSI_VIDEO_MODE_FORMAT_REG: \t\t0x%02x 0x%08x\n", DSI_VIDEO_MODE_FORMAT_REG, dsi_read(dsi, DSI_VIDEO_MODE_FORMAT_REG));
+			"DSI_VIDEO_MODE_FORMAT_REG: \t\t0x%02x 0x%08x\n", DSI_VIDEO_MODE_FORMAT_REG, dsi_read_hw(dsi, DSI_VIDEO_MODE_FORMAT_REG));
 	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
-			"DSI_CLK_EOT_REG: \t\t\t0x%02x 0x%08x\n", DSI_CLK_EOT_REG, dsi_read(dsi, DSI_CLK_EOT_REG));				
+			"DSI_CLK_EOT_REG: \t\t\t0x%02x 0x%08x\n", DSI_CLK_EOT_REG, dsi_read_hw(dsi, DSI_CLK_EOT_REG));				
 	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,	
-			"DSI_POLARITY_REG: \t\t\t0x%02x 0x%08x\n", DSI_POLARITY_REG, dsi_read(dsi, DSI_POLARITY_REG));
+			"DSI_POLARITY_REG: \t\t\t0x%02x 0x%08x\n", DSI_POLARITY_REG, dsi_read_hw(dsi, DSI_POLARITY_REG));
 	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
-			"DSI_CLK_LANE_SWT_REG: \t\t\t0x%02x 0x%08x\n", DSI_CLK_LANE_SWT_REG, dsi_read(dsi, DSI_CLK_LANE_SWT_REG));			
+			"DSI_CLK_LANE_SWT_REG: \t\t\t0x%02x 0x%08x\n", DSI_CLK_LANE_SWT_REG, dsi_read_hw(dsi, DSI_CLK_LANE_SWT_REG));			
 	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,	
-			"DSI_LP_BYTECLK_REG: \t\t\t0x%02x 0x%08x\n", DSI_LP_BYTECLK_REG, dsi_read(dsi, DSI_LP_BYTECLK_REG));
+			"DSI_LP_BYTECLK_REG: \t\t\t0x%02x 0x%08x\n", DSI_LP_BYTECLK_REG, dsi_read_hw(dsi, DSI_LP_BYTECLK_REG));
 	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
-			"DSI_DPHY_PARAM_REG: \t\t\t0x%02x 0x%08x\n", DSI_DPHY_PARAM_REG, dsi_read(dsi, DSI_DPHY_PARAM_REG));			
+			"DSI_DPHY_PARAM_REG: \t\t\t0x%02x 0x%08x\n", DSI_DPHY_PARAM_REG, dsi_read_hw(dsi, DSI_DPHY_PARAM_REG));			
 	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,	
-			"DSI_CLK_LANE_TIMING_PARAM_REG: \t\t0x%02x 0x%08x\n", DSI_CLK_LANE_TIMING_PARAM_REG, dsi_read(dsi, DSI_CLK_LANE_TIMING_PARAM_REG));
+			"DSI_CLK_LANE_TIMING_PARAM_REG: \t\t0x%02x 0x%08x\n", DSI_CLK_LANE_TIMING_PARAM_REG, dsi_read_hw(dsi, DSI_CLK_LANE_TIMING_PARAM_REG));
 	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
-			"DSI_RST_ENABLE_DFE_REG: \t\t0x%02x 0x%08x\n", DSI_RST_ENABLE_DFE_REG, dsi_read(dsi, DSI_RST_ENABLE_DFE_REG));		
+			"DSI_RST_ENABLE_DFE_REG: \t\t0x%02x 0x%08x\n", DSI_RST_ENABLE_DFE_REG, dsi_read_hw(dsi, DSI_RST_ENABLE_DFE_REG));		
 	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
-			"DSI_TRIM0_REG: \t\t\t\t0x%02x 0x%08x\n", DSI_TRIM0_REG, dsi_read(dsi, DSI_TRIM0_REG));
+			"DSI_TRIM0_REG: \t\t\t\t0x%02x 0x%08x\n", DSI_TRIM0_REG, dsi_read_hw(dsi, DSI_TRIM0_REG));
 	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
-			"DSI_TRIM1_REG: \t\t\t\t0x%02x 0x%08x\n", DSI_TRIM1_REG, dsi_read(dsi, DSI_TRIM1_REG));
+			"DSI_TRIM1_REG: \t\t\t\t0x%02x 0x%08x\n", DSI_TRIM1_REG, dsi_read_hw(dsi, DSI_TRIM1_REG));
 	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
-			"DSI_TRIM2_REG: \t\t\t\t0x%02x 0x%08x\n", DSI_TRIM2_REG, dsi_read(dsi, DSI_TRIM2_REG));
+			"DSI_TRIM2_REG: \t\t\t\t0x%02x 0x%08x\n", DSI_TRIM2_REG, dsi_read_hw(dsi, DSI_TRIM2_REG));
 	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
-			"DSI_TRIM3_REG: \t\t\t\t0x%02x 0x%08x\n", DSI_TRIM3_REG, dsi_read(dsi, DSI_TRIM3_REG));	
+			"DSI_TRIM3_REG: \t\t\t\t0x%02x 0x%08x\n", DSI_TRIM3_REG, dsi_read_hw(dsi, DSI_TRIM3_REG));	
 	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
-			"DSI_AUTO_ERR_REC_REG: \t\t\t0x%02x 0x%08x\n", DSI_AUTO_ERR_REC_REG, dsi_read(dsi, DSI_AUTO_ERR_REC_REG));
+			"DSI_AUTO_ERR_REC_REG: \t\t\t0x%02x 0x%08x\n", DSI_AUTO_ERR_REC_REG, dsi_read_hw(dsi, DSI_AUTO_ERR_REC_REG));
 	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
-			"DSI_DIR_DPI_DIFF_REG: \t\t\t0x%02x 0x%08x\n", DSI_DIR_DPI_DIFF_REG, dsi_read(dsi, DSI_DIR_DPI_DIFF_REG));
+			"DSI_DIR_DPI_DIFF_REG: \t\t\t0x%02x 0x%08x\n", DSI_DIR_DPI_DIFF_REG, dsi_read_hw(dsi, DSI_DIR_DPI_DIFF_REG));
 	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
-			"DSI_DATA_LANE_POLARITY_SWAP_REG: \t0x%02x 0x%08x\n", DSI_DATA_LANE_POLARITY_SWAP_REG, dsi_read(dsi, DSI_DATA_LANE_POLARITY_SWAP_REG));					
+			"DSI_DATA_LANE_POLARITY_SWAP_REG: \t0x%02x 0x%08x\n", DSI_DATA_LANE_POLARITY_SWAP_REG, dsi_read_hw(dsi, DSI_DATA_LANE_POLARITY_SWAP_REG));					
 	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
 			"=================================\n");
+	clk_disable_unprepare(dsi->dphy_clk);
+	pm_runtime_put_autosuspend(dsi->dev);
 
 	ret = simple_read_from_buffer(user_buf, count, ppos, buf, len);
 	kfree(buf);
@@ -169,14 +706,228 @@ static const struct file_operations dsi_regs_ops = {
 	.llseek		= default_llseek,
 };
 
+static ssize_t dsi_show_errors(struct file *file, char __user *user_buf,
+		size_t count, loff_t *ppos)
+{
+	struct elv_mipi_dsi *dsi = file->private_data;
+	struct elv_mipi_dsi_priv *priv = to_dsi_priv(dsi);
+	char *buf;
+	u32 len = 0;
+	ssize_t ret;
+	int i;
+
+	buf = kzalloc(DSI_REGS_BUFSIZE, GFP_KERNEL);
+	if (!buf)
+		return 0;
+
+	for (i = 0; i < ARRAY_SIZE(priv->irq_count); i++) {
+		u32 n = atomic_read(&priv->irq_count[i]);
+		
+		if (!elv_dsi_irq_names[i] && !n)
+			continue;
+		if (elv_dsi_irq_names[i])
+			len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
+					"%-24s%u\n", elv_dsi_irq_names[i], n);
+		else
+			len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
+					"bit%-21d%u\n", i, n);
+	}
+	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
+			"%-24s%u\n%-24s%u\n%-24s%u\n", "recoveries", priv->recoveries,
+			"recoveries_merged", priv->recover_skipped,
+			"te_timeouts", priv->te_timeouts);
+
+	ret = simple_read_from_buffer(user_buf, count, ppos, buf, len);
+	kfree(buf);
+	return ret;
+}
+
+static const struct file_operations dsi_errors_ops = {
+	.owner		= THIS_MODULE,
+	.open		= simple_open,
+	.read		= dsi_show_errors,
+	.llseek		= default_llseek,
+};
+
+static ssize_t dsi_show_stats(struct file *file, char __user *user_buf,
+		size_t count, loff_t *ppos)
+{
+	struct elv_mipi_dsi *dsi = file->private_data;
+	struct elv_mipi_dsi_priv *priv = to_dsi_priv(dsi);
+	struct elv_dsi_timings *t = &priv->timings;
+	const struct videomode *vm = &priv->vm;
+	u32 vtotal = vm->vactive + vm->vfront_porch + vm->vback_porch + vm->vsync_len;
+	u32 util = dsi_link_util(priv);
+	u32 errors = 0;
+	char *buf;
+	u32 len = 0;
+	ssize_t ret;
+	int i;
+
+	buf = kzalloc(DSI_REGS_BUFSIZE, GFP_KERNEL);
+	if (!buf)
+		return 0;
+
+	for (i = 0; i < ARRAY_SIZE(priv->irq_count); i++)
+		if (BIT(i) & DSI_INT_ERRORS)
+			errors += atomic_read(&priv->irq_count[i]);
+
+	/*
+	 * Кадры считаются только по событиям кадра: в видеорежиме их
+	 * передаёт драйвер видеовыхода, в командном - TE панели. Без
+	 * источника ноль был бы не измерением, а его отсутствием.
+	 */
+	if (priv->vblank_count || (priv->cmd_mode && priv->te_gpio))
+		len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
+				"frames:\t\t\t%u\n", priv->vblank_count);
+	else
+		len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
+				"frames:\t\t\tnot counted, needs elv_mipi_dsi_vblank() from the video output VSYNC IRQ\n");
+	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
+			"refresh:\t\t%u Hz\n", priv->refresh);
+	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
+			"lines per frame:\t%u (%u active), estimated\n", vtotal, vm->vactive);
+	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
+			"bytes per frame:\t%u, estimated\n", dsi_frame_bytes(priv));
+	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
+			"link:\t\t\t%u lanes x %u Mbps\n", t->lanes, 2 * t->ddr_mhz);
+	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
+			"link utilization:\t%u.%u%%, estimated\n", util / 10, util % 10);
+	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
+			"HS per line:\t\t%u of %u byteclk, estimated\n", t->haa,
+			t->hsync + t->hbp + t->haa + t->hfp);
+	/*
+	 * Счётчика переключений у контроллера нет: линии уходят в LP в
+	 * гашении каждой строки, если на это хватает времени
+	 */
+	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
+			"HS/LP switches:\t\t%u per frame, estimated\n", t->lp_window ? vtotal : 0);
+	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
+			"ULPS entries:\t\t%u\n", priv->rpm_suspends);
+	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
+			"FIFO underflows:\t%u\n",
+			atomic_read(&priv->irq_count[ilog2(DSI_INT_DPI_FIFO_UNDERRUN)]));
+	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
+			"errors:\t\t\t%u\n", errors);
+	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
+			"command updates:\t%u (%llu bytes)\n", priv->cmd_updates, priv->cmd_bytes);
+	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
+			"MMIO reads/writes:\t%u/%u\n", atomic_read(&priv->mmio_reads),
+			atomic_read(&priv->mmio_writes));
+	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
+			"cache reads:\t\t%u\n", atomic_read(&priv->cache_reads));
+	len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
+			"writes skipped:\t\t%u\n", atomic_read(&priv->writes_skipped));
+	for (i = 0; i < DSI_SEQ_NR; i++)
+		len += snprintf(buf + len, DSI_REGS_BUFSIZE - len,
+				"%s:\t%u reads, %u writes\n", elv_dsi_seq_names[i],
+				priv->seq_cost[i].reads, priv->seq_cost[i].writes);
+
+	ret = simple_read_from_buffer(user_buf, count, ppos, buf, len);
+	kfree(buf);
+	return ret;
+}
+
+static const struct file_operations dsi_stats_ops = {
+	.owner		= THIS_MODULE,
+	.open		= simple_open,
+	.read		= dsi_show_stats,
+	.llseek		= default_llseek,
+};
+
+/*
+ * Журнал обращений к шине: запись "1"/"0" включает и выключает его,
+ * "clear" очищает. При чтении - последние DSI_ACCESS_LOG_SIZE обращений
+ * от старых к новым, по строке "W|R смещение значение".
+ */
+static ssize_t dsi_show_access_log(struct file *file, char __user *user_buf,
+		size_t count, loff_t *ppos)
+{
+	struct elv_mipi_dsi *dsi = file->private_data;
+	struct elv_mipi_dsi_priv *priv = to_dsi_priv(dsi);
+	const size_t size = DSI_ACCESS_LOG_SIZE * 24;
+	struct elv_dsi_access *log, *a;
+	unsigned long flags;
+	u32 i, n, first;
+	char *buf;
+	size_t len = 0;
+	ssize_t ret;
+
+	buf = kzalloc(size, GFP_KERNEL);
+	log = kcalloc(DSI_ACCESS_LOG_SIZE, sizeof(*log), GFP_KERNEL);
+	if (!buf || !log) {
+		kfree(buf);
+		kfree(log);
+		return -ENOMEM;
+	}
+
+	spin_lock_irqsave(&priv->log_lock, flags);
+	n = priv->log_count;
+	first = (priv->log_head + DSI_ACCESS_LOG_SIZE - n) % DSI_ACCESS_LOG_SIZE;
+	memcpy(log, priv->log, sizeof(priv->log));
+	spin_unlock_irqrestore(&priv->log_lock, flags);
+
+	for (i = 0; i < n; i++) {
+		a = &log[(first + i) % DSI_ACCESS_LOG_SIZE];
+		len += scnprintf(buf + len, size - len, "%c 0x%02x 0x%08x\n",
+				 a->write ? 'W' : 'R', a->reg, a->val);
+	}
+
+	ret = simple_read_from_buffer(user_buf, count, ppos, buf, len);
+	kfree(log);
+	kfree(buf);
+	return ret;
+}
+
+static ssize_t dsi_write_access_log(struct file *file, const char __user *user_buf,
+		size_t count, loff_t *ppos)
+{
+	struct elv_mipi_dsi *dsi = file->private_data;
+	struct elv_mipi_dsi_priv *priv = to_dsi_priv(dsi);
+	unsigned long flags;
+	char cmd[8] = {};
+
+	if (copy_from_user(cmd, user_buf, min(count, sizeof(cmd) - 1)))
+		return -EFAULT;
+
+	if (sysfs_streq(cmd, "clear")) {
+		spin_lock_irqsave(&priv->log_lock, flags);
+		priv->log_head = 0;
+		priv->log_count = 0;
+		spin_unlock_irqrestore(&priv->log_lock, flags);
+	} else if (sysfs_streq(cmd, "1")) {
+		WRITE_ONCE(priv->log_enabled, true);
+	} else if (sysfs_streq(cmd, "0")) {
+		WRITE_ONCE(priv->log_enabled, false);
+	} else {
+		return -EINVAL;
+	}
+	return count;
+}
+
+static const struct file_operations dsi_access_log_ops = {
+	.owner		= THIS_MODULE,
+	.open		= simple_open,
+	.read		= dsi_show_access_log,
+	.write		= dsi_write_access_log,
+	.llseek		= default_llseek,
+};
+
 static int dsi_debugfs_init(struct elv_mipi_dsi *dsi)
 {
+	spin_lock_init(&to_dsi_priv(dsi)->log_lock);
 	dsi->debugfs = debugfs_create_dir("mipi_dsi", NULL);	
 	if (!dsi->debugfs)
 		return -ENOMEM;
 
 	debugfs_create_file("registers", S_IFREG | S_IRUGO,
 		dsi->debugfs, (void *)dsi, &dsi_regs_ops);
+	debugfs_create_file("errors", S_IFREG | S_IRUGO,
+		dsi->debugfs, (void *)dsi, &dsi_errors_ops);
+	debugfs_create_file("stats", S_IFREG | S_IRUGO,
+		dsi->debugfs, (void *)dsi, &dsi_stats_ops);
+	debugfs_create_file("access_log", S_IFREG | S_IRUGO | S_IWUSR,
+		dsi->debugfs, (void *)dsi, &dsi_access_log_ops);
 	return 0;
 }
 
@@ -196,34 +947,119 @@ static inline void dsi_debugfs_remove(struct elv_mipi_dsi *dsi)
 }
 #endif /* CONFIG_DEBUG_FS */
 
+static int elv_mipi_dsi_is_enable(struct elv_mipi_dsi *dsi)
+{
+	u32 ret;
+	
+	ret = dsi_read(dsi, DSI_DEVICE_READY_REG);
+	return (ret & DEVICE_ENABLE);
+}
+
+/* Пакеты shutdown/turn-on peripheral идут через DPI, в командном режиме их нет */
+static void elv_mipi_dsi_dpi_control(struct elv_mipi_dsi *dsi, u32 cmd)
+{
+	if (!to_dsi_priv(dsi)->cmd_mode)
+		dsi_write(dsi, DSI_DPI_CONTROL_REG, cmd);
+}
+
 static void elv_mipi_dsi_turn_on(struct elv_mipi_dsi *dsi)
 {
 	dsi_write(dsi, DSI_DEVICE_READY_REG, DEVICE_ENABLE);	
 	dsi->ulp_mode = 0;
 }
 
+/* Полное выключение контроллера, после него нужен сброс DFE */
+static void elv_mipi_dsi_disable(struct elv_mipi_dsi *dsi)
+{
+	elv_mipi_dsi_dpi_control(dsi, TURN_OFF_PERIPHERAL);
+	dsi_write(dsi, DSI_DEVICE_READY_REG, 0);
+	
+	dsi->ulp_mode = 1;
+}
+
+/*
+ * dphy_clk нужен только передающему линку: в ULPS и при выключенном
+ * контроллере он отключается, перед любым выходом из этих состояний -
+ * включается снова. Повторные вызовы ничего не делают.
+ */
+static void elv_mipi_dsi_dphy_clk_off(struct elv_mipi_dsi *dsi)
+{
+	struct elv_mipi_dsi_priv *priv = to_dsi_priv(dsi);
+	
+	if (priv->dphy_gated)
+		return;
+	
+	clk_disable_unprepare(dsi->dphy_clk);
+	priv->dphy_gated = true;
+	priv->dphy_gate_stamp = ktime_get();
+	priv->dphy_gates++;
+}
+
+static int elv_mipi_dsi_dphy_clk_on(struct elv_mipi_dsi *dsi)
+{
+	struct elv_mipi_dsi_priv *priv = to_dsi_priv(dsi);
+	int ret;
+	
+	if (!priv->dphy_gated)
+		return 0;
+	
+	ret = clk_prepare_enable(dsi->dphy_clk);
+	if (ret < 0) {
+		dev_err(dsi->dev, "Could not prepare or enable D-PHY clock\n");
+		return ret;
+	}
+	priv->dphy_gated = false;
+	priv->dphy_off_us += ktime_us_delta(ktime_get(), priv->dphy_gate_stamp);
+	return 0;
+}
+
 static void elv_mipi_dsi_normal_mode(struct elv_mipi_dsi *dsi)
 {
-	/*dsi_write(dsi, DSI_DEVICE_READY_REG, (DEVICE_EXIT_MODE | DEVICE_ENABLE));
-	msleep(2);
+	struct elv_mipi_dsi_priv *priv = to_dsi_priv(dsi);
+	struct elv_dsi_cost cost = dsi_seq_start(priv);
+	ktime_t start = ktime_get();
+	
+	if (elv_mipi_dsi_dphy_clk_on(dsi))
+		return;
+	
+	/* Контроллер был выключен полностью (u-boot, reprogram) */
+	if (!elv_mipi_dsi_is_enable(dsi))
+		goto restart;
+	
+	dsi_write(dsi, DSI_DEVICE_READY_REG, (DEVICE_EXIT_MODE | DEVICE_ENABLE));
+	usleep_range(DSI_ULPS_WAKEUP_US, DSI_ULPS_WAKEUP_US + 500);
 	dsi_write(dsi, DSI_DEVICE_READY_REG, (DEVICE_NORMAL_MODE | DEVICE_ENABLE));
-	dsi_write(dsi, DSI_DPI_CONTROL_REG, TURN_ON_PERIPHERAL);*/
+	elv_mipi_dsi_dpi_control(dsi, TURN_ON_PERIPHERAL);
+	goto out;
 	
+restart:
 	dsi_write(dsi, DSI_RST_ENABLE_DFE_REG, DFE_RST_ENABLE);
 	dsi_write(dsi, DSI_DEVICE_READY_REG, DEVICE_ENABLE);
-	dsi_write(dsi, DSI_DPI_CONTROL_REG, TURN_ON_PERIPHERAL);
-	
+	elv_mipi_dsi_dpi_control(dsi, TURN_ON_PERIPHERAL);
+out:
+	priv->ulps_exit_us = ktime_us_delta(ktime_get(), start);
+	dsi_seq_end(priv, DSI_SEQ_ULPS_EXIT, cost);
 	dsi->ulp_mode = 0;
 }
 
+/*
+ * Перевод линий в ULPS без выключения контроллера: конфигурация и PLL
+ * сохраняются, поэтому выход не требует сброса DFE. После отправки
+ * escape-последовательности выключается dphy_clk.
+ */
 static void elv_mipi_dsi_ulp_mode(struct elv_mipi_dsi *dsi)
 {
-	/*dsi_write(dsi, DSI_DPI_CONTROL_REG, TURN_OFF_PERIPHERAL);
-	dsi_write(dsi, DSI_DEVICE_READY_REG, (DEVICE_ULP_MODE | DEVICE_ENABLE));*/
+	struct elv_mipi_dsi_priv *priv = to_dsi_priv(dsi);
+	struct elv_dsi_cost cost = dsi_seq_start(priv);
+	ktime_t start = ktime_get();
 	
-	dsi_write(dsi, DSI_DPI_CONTROL_REG, TURN_OFF_PERIPHERAL);
-	dsi_write(dsi, DSI_DEVICE_READY_REG, 0);
+	elv_mipi_dsi_dpi_control(dsi, TURN_OFF_PERIPHERAL);
+	dsi_write(dsi, DSI_DEVICE_READY_REG, (DEVICE_ULP_MODE | DEVICE_ENABLE));
+	usleep_range(DSI_ULPS_ENTER_US, DSI_ULPS_ENTER_US + 50);
+	elv_mipi_dsi_dphy_clk_off(dsi);
 	
+	priv->ulps_enter_us = ktime_us_delta(ktime_get(), start);
+	dsi_seq_end(priv, DSI_SEQ_ULPS_ENTER, cost);
 	dsi->ulp_mode = 1;
 }
 
@@ -251,14 +1087,20 @@ static ssize_t elv_mipi_dsi_ulp_mode_store(struct device *dev,
     if (ret)
 		return ret;
 	
-	if (val == 0) 
-		elv_mipi_dsi_normal_mode(dsi);
-	else if (val == 1) 
-		elv_mipi_dsi_ulp_mode(dsi);
-	else {
+	if (val != 0 && val != 1) {
 		dev_err(dev, "Invalid value: %lu\n", val);
 		return -ENXIO;
 	}
+	
+	pm_runtime_get_sync(dev);
+	mutex_lock(&to_dsi_priv(dsi)->lock);
+	if (val == 0 && dsi->ulp_mode) 
+		elv_mipi_dsi_normal_mode(dsi);
+	else if (val == 1 && !dsi->ulp_mode) 
+		elv_mipi_dsi_ulp_mode(dsi);
+	mutex_unlock(&to_dsi_priv(dsi)->lock);
+	pm_runtime_mark_last_busy(dev);
+	pm_runtime_put_autosuspend(dev);
 			
     return count;
 }
@@ -266,388 +1108,1870 @@ static ssize_t elv_mipi_dsi_ulp_mode_store(struct device *dev,
 static DEVICE_ATTR(ulp_mode, S_IRUGO | S_IWUSR, elv_mipi_dsi_ulp_mode_show,
                    elv_mipi_dsi_ulp_mode_store);
 
-static void elv_mipi_dsi_config_dsi(struct elv_mipi_dsi *dsi)
-{	
-	struct mipi_dsi_config *dsi_config = &dsi->dsi_config;
-	
-	dsi_config->data_lanes = DSI_DataLanes_2;
-	/*dsi_config->video_format = DSI_video_format_RGB666;*/	
-	dsi_config->video_format = DSI_video_format_RGB888;
-	dsi_config->ch_video_mode = DSI_virt_ch_0;
+static ssize_t elv_mipi_dsi_ulps_latency_show(struct device *dev,
+        struct device_attribute *attr, char *buf)
+{
+    struct elv_mipi_dsi_priv *priv = to_dsi_priv(dev_get_drvdata(dev));
+
+    return sprintf(buf, "enter %u us\nexit %u us\n",
+                   priv->ulps_enter_us, priv->ulps_exit_us);
+}
+
+static DEVICE_ATTR(ulps_latency, S_IRUGO, elv_mipi_dsi_ulps_latency_show, NULL);
+
+static ssize_t elv_mipi_dsi_context_restore_show(struct device *dev,
+        struct device_attribute *attr, char *buf)
+{
+    struct elv_mipi_dsi_priv *priv = to_dsi_priv(dev_get_drvdata(dev));
+
+    return sprintf(buf, "restores %u\nlast %u us\nregisters %zu\n",
+                   priv->ctx_restores, priv->ctx_restore_us,
+                   ARRAY_SIZE(elv_dsi_ctx_regs));
+}
+
+static DEVICE_ATTR(context_restore, S_IRUGO, elv_mipi_dsi_context_restore_show, NULL);
+
+static ssize_t elv_mipi_dsi_rpm_residency_show(struct device *dev,
+        struct device_attribute *attr, char *buf)
+{
+    struct elv_mipi_dsi_priv *priv = to_dsi_priv(dev_get_drvdata(dev));
+    u64 active, suspended, dphy_off, now;
+
+    mutex_lock(&priv->lock);
+    active = priv->rpm_active_us;
+    suspended = priv->rpm_suspended_us;
+    now = ktime_us_delta(ktime_get(), priv->rpm_stamp);
+    if (pm_runtime_status_suspended(dev))
+        suspended += now;
+    else
+        active += now;
+    dphy_off = priv->dphy_off_us;
+    if (priv->dphy_gated)
+        dphy_off += ktime_us_delta(ktime_get(), priv->dphy_gate_stamp);
+    mutex_unlock(&priv->lock);
+
+    return sprintf(buf, "active %llu ms\nsuspended %llu ms\nsuspends %u\n"
+                   "dphy_clk off %llu ms\ndphy_clk gates %u\n",
+                   div_u64(active, 1000), div_u64(suspended, 1000),
+                   priv->rpm_suspends, div_u64(dphy_off, 1000), priv->dphy_gates);
+}
+
+static DEVICE_ATTR(rpm_residency, S_IRUGO, elv_mipi_dsi_rpm_residency_show, NULL);
+
+/* "счётчик время_нс"; файл поддерживает poll(), событие - каждый кадр */
+static ssize_t elv_mipi_dsi_vblank_show(struct device *dev,
+        struct device_attribute *attr, char *buf)
+{
+    struct elv_mipi_dsi_priv *priv = to_dsi_priv(dev_get_drvdata(dev));
+    unsigned long flags;
+    ktime_t ts;
+    u32 count;
+
+    spin_lock_irqsave(&priv->vblank_lock, flags);
+    count = priv->vblank_count;
+    ts = priv->vblank_ts;
+    spin_unlock_irqrestore(&priv->vblank_lock, flags);
+
+    return sprintf(buf, "%u %lld\n", count, ktime_to_ns(ts));
+}
+
+static DEVICE_ATTR(vblank, S_IRUGO, elv_mipi_dsi_vblank_show, NULL);
+
+/* Заполняет dsi_config и возвращает значение DSI_FUNC_PRG_REG */
+static u32 elv_mipi_dsi_calc_config(struct elv_mipi_dsi *dsi)
+{
+	struct elv_mipi_dsi_priv *priv = to_dsi_priv(dsi);
+	struct mipi_dsi_config *dsi_config = &dsi->dsi_config;
+	
+	/* Локальная раскладка полей должна совпадать с константами заголовка */
+	BUILD_BUG_ON(DSI_FUNC_PRG_LANES(2) != DATA_LANES_2);
+	BUILD_BUG_ON(DSI_FUNC_PRG_VM_FMT(4) != RGB888);
+	BUILD_BUG_ON(DSI_FUNC_PRG_VM_CHAN(0) != VM_CHAN_NO_0);
+	
+	dsi_config->data_lanes = priv->lanes;
+	dsi_config->video_format = priv->format->video_format;
+	dsi_config->ch_video_mode = DSI_virt_ch_0 + priv->video_vc;
+	
+	/* В burst-режиме строка передаётся на удвоенной частоте линка, 
+	   а остаток строки линия проводит в LP */
+	if (priv->burst_mode)
+		dsi_config->video_mode = DSI_vd_mode_burst;
+	else
+		dsi_config->video_mode = DSI_vd_mode_non_burst_sync_pulse;
+	
+	/* В командном режиме видеоформат не задаётся, и контроллер не ведёт DPI */
+	if (priv->cmd_mode)
+		return DSI_FUNC_PRG_LANES(priv->lanes) | DSI_FUNC_PRG_CM_WIDTH_8BIT |
+		       DSI_FUNC_PRG_CM_CHAN(priv->video_vc);
+	
+	return DSI_FUNC_PRG_LANES(priv->lanes) | priv->format->func_prg_fmt |
+	       DSI_FUNC_PRG_VM_CHAN(priv->video_vc);
+}
+
+static u32 elv_mipi_dsi_video_mode_format(struct elv_mipi_dsi *dsi)
+{
+	struct elv_mipi_dsi_priv *priv = to_dsi_priv(dsi);
+	
+	if (priv->cmd_mode)
+		return 0;
+	return priv->burst_mode ? BURST_MODE : NON_BURST_WITH_SYNC_PULSES;
+}
+
+/*
+ * В командном режиме DPI не работает и его FIFO всегда пуст: без маски
+ * underrun непрерывно запускал бы восстановление линка.
+ */
+static u32 elv_mipi_dsi_irq_mask(struct elv_mipi_dsi_priv *priv)
+{
+	u32 mask = DSI_INT_ERRORS | INT_OUTFIFO | DSI_INT_GEN_READ_DATA;
+	
+	return priv->cmd_mode ? mask & ~DSI_INT_DPI_FIFO_UNDERRUN : mask;
+}
+
+/* Регистры, запись которых не прерывает работающий линк */
+static void elv_mipi_dsi_config_irq(struct elv_mipi_dsi *dsi)
+{
+	dsi_write(dsi, DSI_AUTO_ERR_REC_REG, ECC_MUL_ERR_CLR);
+	dsi_write(dsi, DSI_IRQ_ENABLE_REG, elv_mipi_dsi_irq_mask(to_dsi_priv(dsi)));
+}
+
+/*
+ * В режиме non-continuous clock линия тактирования переходит в LP вместе
+ * с линиями данных, в гашении строки HS-тактов на линии нет.
+ */
+static u32 elv_mipi_dsi_clk_eot(struct elv_mipi_dsi *dsi, bool bta)
+{
+	BUILD_BUG_ON((ENABLE_VIDEO_BTA | DISABLE_VIDEO_BTA) & DSI_CLK_EOT_CLOCKSTOP);
+	
+	return (bta ? ENABLE_VIDEO_BTA : DISABLE_VIDEO_BTA) |
+	       (to_dsi_priv(dsi)->clk_noncont ? DSI_CLK_EOT_CLOCKSTOP : 0);
+}
+
+static void elv_mipi_dsi_set_base_timings(struct elv_mipi_dsi *dsi)
+{
+	dsi_write(dsi, DSI_HS_TX_TIMEOUT_REG, 0xFFFFFF);
+	dsi_write(dsi, DSI_LP_RX_TIMEOUT_REG, 0xFFFFFF);
+	dsi_write(dsi, DSI_DEVICE_RESET_REG, 0xFF);
+	dsi_write(dsi, DSI_INIT_COUNT_REG, 0x7D0);
+}
+
+/*
+ * Интервалы D-PHY вида "A нс + k*UI" без округления представляются как
+ * t_ps * ddr_clk_freq (пс*МГц): при UI = 500000/ddr пс такое произведение
+ * всегда целое. Число тактов byteclk тогда равно x / 4000000 точно.
+ */
+static s64 dsi_ps_ddr_to_byteclk(s64 x, bool round_up)
+{
+	if (x <= 0)
+		return div_s64(x, 4000000);
+	if (round_up)
+		return div_s64(x + 4000000 - 1, 4000000);
+	return div_s64(x + 2000000, 4000000);
+}
+
+/* Перевод интервала в пикселях в такты byteclk: ceil(n * t_pclk / t_byteclk) */
+static u32 dsi_pix_to_byteclk(const struct elv_dsi_timings *t, u32 pixels)
+{
+	return DIV_ROUND_UP_ULL((u64)pixels * t->ddr_mhz * 1000,
+				4ULL * t->pclk_khz);
+}
+
+static u32 dsi_clamp_count(s64 v)
+{
+	return v < 0 ? 0 : (u32)v;
+}
+
+/* Удлинение интервала на pct процентов */
+static s64 dsi_stretch(s64 x, u32 pct)
+{
+	return div_s64(x * (100 + pct), 100);
+}
+
+/*
+ * Расчёт параметров D-PHY по формулам из примера "MIPI DSI test" от Элвиса.
+ * Константы 115, 60, 170, 30 и т.п. взяты из документа "MIPI Alliance
+ * Specification for D-PHY Version 1.00.00 - 14 May 2009", таблица 14 на стр. 53
+ * (п. 5.9): выбраны средние допустимые значения из этой таблицы, либо, если
+ * указана только нижняя граница, значения с небольшим отступом от этой границы.
+ * Интервалы считаются в пикосекундах, UI = 500000/ddr_clk_freq пс.
+ */
+static void elv_mipi_dsi_calc_dphy_timings(struct elv_dsi_timings *t)
+{
+	const s64 n = 1;	/* 1 для Forward-direction HS mode, 4 для Reverse-direction HS mode */
+	const s64 ddr = t->ddr_mhz;
+	const s64 ui = 500000;	/* UI * ddr, пс*МГц */
+	s64 hs_prep, hs_zero, hs_trail, hs_exit;
+	s64 clk_prep, clk_zero, clk_trail, clk_exit;
+	
+	/* Все интервалы ниже - в пс*МГц, см. dsi_ps_ddr_to_byteclk() */
+	hs_prep = 60000 * ddr + 4 * ui;
+	hs_zero = 170000 * ddr + 10 * ui - hs_prep;
+	hs_trail = max(n * 8 * ui, 60000 * ddr + n * 4 * ui) + 30000 * ddr;
+	hs_exit = 115000 * ddr;
+	
+	clk_prep = 60000 * ddr;
+	clk_zero = 330000 * ddr - clk_prep;
+	clk_trail = 60000 * ddr;
+	clk_exit = 60000 * ddr;
+	
+	/*
+	 * Запас для зашумлённого линка (см. elv_mipi_dsi_link_work()).
+	 * HS-PREPARE ограничен сверху и не меняется, у остальных
+	 * интервалов в таблице задана только нижняя граница.
+	 */
+	if (t->margin_pct) {
+		hs_zero = dsi_stretch(hs_zero, t->margin_pct);
+		hs_trail = dsi_stretch(hs_trail, t->margin_pct);
+		hs_exit = dsi_stretch(hs_exit, t->margin_pct);
+		clk_zero = dsi_stretch(clk_zero, t->margin_pct);
+		clk_trail = dsi_stretch(clk_trail, t->margin_pct);
+		clk_exit = dsi_stretch(clk_exit, t->margin_pct);
+	}
+	
+	t->dln_hs_prep = dsi_clamp_count(dsi_ps_ddr_to_byteclk(
+				abs64(hs_prep - 18 * ui), false) - 1);
+	t->dln_hs_zero = dsi_clamp_count(dsi_ps_ddr_to_byteclk(hs_zero, true) - 1);
+	t->dln_hs_trail = dsi_clamp_count(dsi_ps_ddr_to_byteclk(hs_trail, true) - 2);
+	t->dln_hs_exit = dsi_clamp_count(dsi_ps_ddr_to_byteclk(hs_exit, true) - 1);
+	
+	t->cln_prep = dsi_clamp_count(dsi_ps_ddr_to_byteclk(clk_prep, true) - 1);
+	t->cln_zero = dsi_clamp_count(dsi_ps_ddr_to_byteclk(clk_zero, true) - 1);
+	t->cln_hs_trail = dsi_clamp_count(dsi_ps_ddr_to_byteclk(
+				clk_trail - 6 * ui, true) + 3);
+	t->cln_hs_exit = dsi_clamp_count(dsi_ps_ddr_to_byteclk(
+				clk_exit - 4 * ui, true) - 1);
+	
+	t->lp_byteclk = DIV_ROUND_UP(t->ddr_mhz, 12 * 4);
+	
+	/*
+	 * Все слагаемые - в тактах byteclk: k*t_byteclk из исходных формул
+	 * даёт ровно k тактов, а 8 UI (8*500/ddr нс) - один такт byteclk.
+	 */
+	t->high_ls_count = 4 * t->lp_byteclk + t->dln_hs_prep + t->dln_hs_zero + 4;
+	t->hs_to_lp = t->cln_hs_trail + t->cln_hs_exit + 3;
+	t->lp_to_hs = 4 * t->lp_byteclk + t->cln_prep + t->cln_zero +
+		      dsi_ps_ddr_to_byteclk(8 * ui, true) + 4;
+	
+	/* Таймаут ожидания ответа после BTA в тактах byteclk (ddr/4 МГц) */
+	t->ta_timeout = DIV_ROUND_UP(t->ddr_mhz * DSI_BTA_TIMEOUT_US, 4);
+}
+
+/*
+ * Рабочая точка PLL допустима, если рассчитанные параметры D-PHY помещаются
+ * в поля регистров и в горизонтальном гашении хватает времени на переход
+ * линий данных HS -> LP -> HS, а в режиме non-continuous clock - ещё и
+ * линии тактирования. Заголовок и CRC длинного пакета (6 байт)
+ * передаются вместе с активной частью строки.
+ */
+static bool elv_mipi_dsi_pll_valid(struct elv_dsi_timings *t,
+				   const struct videomode *vm, bool burst)
+{
+	u32 line, active, lp;
+	
+	elv_mipi_dsi_calc_dphy_timings(t);
+	
+	if (t->dln_hs_prep > 0xff || t->dln_hs_zero > 0xff ||
+	    t->dln_hs_trail > 0xff || t->dln_hs_exit > 0xff ||
+	    t->cln_prep > 0xff || t->cln_zero > 0xff ||
+	    t->cln_hs_trail > 0xff || t->cln_hs_exit > 0xff ||
+	    t->hs_to_lp > 0xffff || t->lp_to_hs > 0xffff)
+		return false;
+	
+	line = dsi_pix_to_byteclk(t, vm->hactive + vm->hfront_porch +
+				     vm->hback_porch + vm->hsync_len);
+	if (burst)
+		active = DIV_ROUND_UP(vm->hactive * t->bpp, 8 * t->lanes);
+	else
+		active = dsi_pix_to_byteclk(t, vm->hactive);
+	active += DIV_ROUND_UP(6, t->lanes);
+	
+	lp = t->high_ls_count;
+	if (t->clk_noncont)
+		lp += t->hs_to_lp + t->lp_to_hs;
+	if (line < active + lp)
+		return false;
+	
+	t->lp_window = line - active - lp;
+	return true;
+}
+
+/*
+ * Поиск минимальной частоты линка, на которой режим передаётся с
+ * корректными таймингами D-PHY. Делитель PLL перебирается от нижней
+ * границы по пропускной способности вверх: лишняя частота линка только
+ * увеличивает потребление и излучение. Если подходящей точки нет,
+ * остаётся максимальная частота и возвращается -ERANGE.
+ */
+static int elv_mipi_dsi_pll_search(struct elv_dsi_timings *t,
+				   const struct videomode *vm, bool burst)
+{
+	u32 ratio, first, last;
+	
+	first = max_t(u32, DIV_ROUND_UP(t->req_khz, 12 * 1000), div_ratio_min);
+	last = min_t(u32, DDR_CLK_FREQ_MAX / 12, div_ratio_max);
+	
+	for (ratio = first; ratio <= last; ratio++) {
+		t->div_ratio = ratio;
+		t->ddr_mhz = ratio * 12;
+		if (elv_mipi_dsi_pll_valid(t, vm, burst))
+			return 0;
+	}
+	
+	t->div_ratio = last;
+	t->ddr_mhz = last * 12;
+	t->lp_window = 0;
+	elv_mipi_dsi_calc_dphy_timings(t);
+	return -ERANGE;
+}
+
+/*
+ * Консервативная рабочая точка для уровня запаса level > 0. Частота линка
+ * не поднимается выше номинальной (уровень 0, уже выбрана в t): делитель
+ * PLL снижается до level шагов вниз, пока поток пикселей помещается в
+ * линк, а интервалы D-PHY удлиняются на level * DSI_LINK_MARGIN_PCT %.
+ * Если с таким удлинением переходы не помещаются в гашение ни на одной
+ * частоте не выше номинальной, удлинение уменьшается по шагу. Снизить
+ * частоту удаётся только при запасе над номинальной точкой, то есть в
+ * burst-режиме; в non-burst номинальная точка уже минимальна, и уровень
+ * только удлиняет интервалы.
+ */
+static void elv_mipi_dsi_pll_conservative(struct elv_dsi_timings *t,
+					  const struct videomode *vm, bool burst,
+					  u32 level)
+{
+	u32 nominal = t->div_ratio;
+	u32 ratio, first, margin;
+	
+	first = max_t(u32, DIV_ROUND_UP(t->pclk_khz * t->bpp, 2 * t->lanes * 12 * 1000),
+		      div_ratio_min);
+	if (nominal > first + level)
+		first = nominal - level;
+	
+	for (margin = level * DSI_LINK_MARGIN_PCT; margin; margin -= DSI_LINK_MARGIN_PCT) {
+		t->margin_pct = margin;
+		for (ratio = first; ratio <= nominal; ratio++) {
+			t->div_ratio = ratio;
+			t->ddr_mhz = ratio * 12;
+			if (elv_mipi_dsi_pll_valid(t, vm, burst))
+				return;
+		}
+	}
+	
+	/* Номинальная точка допустима по построению */
+	t->margin_pct = 0;
+	t->div_ratio = nominal;
+	t->ddr_mhz = nominal * 12;
+	elv_mipi_dsi_pll_valid(t, vm, burst);
+}
+
+/* Запас частоты линка над необходимой, в десятых долях процента */
+static u32 elv_mipi_dsi_pll_margin(const struct elv_dsi_timings *t)
+{
+	if (!t->req_khz)
+		return 0;
+	return div_u64((u64)(t->ddr_mhz * 1000 - min(t->req_khz, t->ddr_mhz * 1000)) * 1000,
+		       t->req_khz);
+}
+
+/* Возвращает -ERANGE, если для режима нет допустимой рабочей точки PLL */
+static int elv_mipi_dsi_ddr_clk_calc(struct elv_mipi_dsi *dsi)
+{	
+	struct mipi_dsi_config *dsi_config = &dsi->dsi_config;	
+	struct elv_dsi_timings *t = &to_dsi_priv(dsi)->timings;
+	int pixel_format = 0, video_mode_format = 0, lane_count = 1;
+	struct videomode *vm = &to_dsi_priv(dsi)->vm;
+	int ret;
+	
+	/* Частота pixclk берётся из display-timings, иначе - делитель AXI */
+	if (vm->pixelclock)
+		t->pclk_khz = DIV_ROUND_CLOSEST(vm->pixelclock, 1000);
+	else
+		t->pclk_khz = DIV_ROUND_CLOSEST(AXI_CLK_MHZ * 1000, PCLK_DIV + 1);
+	t->t_pclk_ps = DIV_ROUND_CLOSEST(1000000000, t->pclk_khz);
+	dsi_config->pclk_freq = t->pclk_khz / 1000;
+	dsi_config->t_pclk = t->t_pclk_ps / 1000;
+	
+	switch (dsi_config->video_format) {
+		case DSI_video_format_RGB565:
+			pixel_format = 16;
+			break;
+		case DSI_video_format_RGB666:
+			pixel_format = 18;
+			break;
+		case DSI_video_format_RGB666_lp:
+		case DSI_video_format_RGB888:
+			pixel_format = 24;		
+			break;
+		default:
+			break;
+  }
+  
+  if (dsi_config->video_mode == DSI_vd_mode_burst)
+    video_mode_format = 2;
+  else
+    video_mode_format = 1;
+  lane_count = dsi_config->data_lanes;
+  t->bpp = pixel_format;
+  t->lanes = lane_count;
+  t->clk_noncont = to_dsi_priv(dsi)->clk_noncont;
+  t->margin_pct = 0;
+
+  t->req_khz = (t->pclk_khz * pixel_format * video_mode_format) / (2*lane_count);
+  
+  /* Частота PLL задаётся с шагом 12 МГц, ищем минимальную подходящую */
+  ret = elv_mipi_dsi_pll_search(t, vm, dsi_config->video_mode == DSI_vd_mode_burst);
+  if (ret) {
+    dev_err(dsi->dev, "No valid ddr_clk for %u kHz pixclk, using %u MHz\n",
+            t->pclk_khz, t->ddr_mhz);
+  } else if (to_dsi_priv(dsi)->link_level) {
+    elv_mipi_dsi_pll_conservative(t, vm, dsi_config->video_mode == DSI_vd_mode_burst,
+                                  to_dsi_priv(dsi)->link_level);
+  }
+  
+  dev_dbg(dsi->dev, "PLL div_ratio %u, ddr_clk %u MHz, required %u kHz, margin %u.%u%%, LP window %u byteclk\n",
+          t->div_ratio, t->ddr_mhz, t->req_khz,
+          elv_mipi_dsi_pll_margin(t) / 10, elv_mipi_dsi_pll_margin(t) % 10,
+          t->lp_window);
+  
+  /* t_byteclk считаем от фактической частоты PLL, а не от требуемой */
+  t->t_byteclk_ps = DIV_ROUND_CLOSEST(4000000, t->ddr_mhz);
+  dsi_config->t_byteclk = t->t_byteclk_ps / 1000;
+  dsi_config->ddr_freq = t->ddr_mhz;
+  return ret;
+}
+
+static void elv_mipi_dsi_calc_dpi_resolution(struct elv_mipi_dsi *dsi)
+{
+	/* Все значения записываются уменьшенные на единицу, измеряются в количестве тактов частоты PIXCLK
+	* hsw - это HSYNC pulse width  
+	* hgdel_hbp - это Horizontal back porch, (HBP)
+	* hgate_haa - это количество активных пикселей в строке - Horizontal active area (HDISP)
+	* hlen - это var->xres + var->left_margin + var->right_margin + var->hsync_len - 1
+	* vsw - это VSYNC pulse width
+	* vgdel_vbp - это Vertical back porch (VBP)
+	* vgate_vaa - это количество активных строк в кадре - Vertical active area (VDISP)
+	* vlen - это var->yres + var->upper_margin + var->lower_margin + var->vsync_len - 1
+	*/
+	
+	struct mipi_dsi_config *dsi_config = &dsi->dsi_config;
+	struct elv_dsi_timings *t = &to_dsi_priv(dsi)->timings;
+	struct videomode *vm = &to_dsi_priv(dsi)->vm;
+	int hsw = vm->hsync_len - 1, hgdel_hbp = vm->hback_porch - 1, hgate_haa = vm->hactive - 1;
+	int hlen = vm->hactive + vm->hfront_porch + vm->hback_porch + vm->hsync_len - 1;
+	/* Значения vsw и vgdel_vbp должны совпадать со значением из команды SETDISP 
+	   (amount of scan line) см. panel-hx8369a-spi.c */
+	int vsw = vm->vsync_len - 1, vgdel_vbp = vm->vback_porch - 1, vgate_vaa = vm->vactive - 1;
+	int vlen = vm->vactive + vm->vfront_porch + vm->vback_porch + vm->vsync_len - 1;
+	
+	dsi_config->DPI_resolution_h = hgate_haa + 1;
+	dsi_config->DPI_resolution_v = vgate_vaa + 1;
+	dsi_config->HSYNC_count = hsw + 1;
+	dsi_config->HSYNC_bpc = hgdel_hbp + 1;
+	dsi_config->HSYNC_fpc = (hlen + 1) - (hgate_haa + 1) - (hgdel_hbp + 1) - (hsw + 1);
+	dsi_config->HSYNC_aac = hgate_haa + 1;
+	dsi_config->VSYNC_count = vsw + 1;
+	dsi_config->VSYNC_bpc = vgdel_vbp + 1;
+	dsi_config->VSYNC_fpc = (vlen + 1) - (vgate_vaa + 1) - (vgdel_vbp + 1) - (vsw + 1);
+	
+	/* Горизонтальные интервалы переводятся из тактов PIXCLK в такты byteclk */
+	t->hsync = dsi_pix_to_byteclk(t, dsi_config->HSYNC_count);
+	t->hbp = dsi_max(dsi_pix_to_byteclk(t, dsi_config->HSYNC_bpc), HSYNC_bpc_min);
+	t->hfp = dsi_max(dsi_pix_to_byteclk(t, dsi_config->HSYNC_fpc), HSYNC_fpc_min);
+	t->haa = dsi_pix_to_byteclk(t, dsi_config->HSYNC_aac);
 	
-	/*dsi_write(dsi, DSI_FUNC_PRG_REG, (DATA_LANES_2 | RGB666 | 
-		VM_CHAN_NO_0));	*/
-	dsi_write(dsi, DSI_FUNC_PRG_REG, (DATA_LANES_2 | RGB888 | 
-		VM_CHAN_NO_0));
+	/* В burst-режиме активная часть занимает только время передачи данных 
+	   на линии, а длительность строки сохраняется за счёт front porch */
+	if (dsi_config->video_mode == DSI_vd_mode_burst) {
+		u32 line = dsi_pix_to_byteclk(t, hlen + 1);
 		
-	//dsi_config->video_mode = DSI_vd_mode_burst;	
-	dsi_config->video_mode = DSI_vd_mode_non_burst_sync_pulse;
+		t->haa = DIV_ROUND_UP(dsi_config->HSYNC_aac * t->bpp, 8 * t->lanes);
+		t->hfp = dsi_max(line - t->hsync - t->hbp - t->haa, HSYNC_fpc_min);
+	}
+}
+
+static u32 elv_mipi_dsi_dpi_resolution(struct elv_mipi_dsi *dsi)
+{
+	return dsi->dsi_config.DPI_resolution_h |
+	       (dsi->dsi_config.DPI_resolution_v << 16);
+}
+
+static u32 elv_mipi_dsi_dphy_param(const struct elv_dsi_timings *t)
+{
+	return t->dln_hs_prep | (t->dln_hs_zero << 8) |
+	       (t->dln_hs_trail << 16) | (t->dln_hs_exit << 24);
+}
+
+static u32 elv_mipi_dsi_trim1(struct elv_mipi_dsi *dsi)
+{
+	unsigned int div_ratio, l_div_ratio, other_bits;
+	
+	/* Делитель уже выбран в elv_mipi_dsi_pll_search() */
+	div_ratio = to_dsi_priv(dsi)->timings.div_ratio;
+	
+	if (div_ratio < div_ratio_min)
+		l_div_ratio = div_ratio_min;
+	else if (div_ratio > div_ratio_max)
+		l_div_ratio = div_ratio_max;
+	else
+		l_div_ratio = div_ratio;	
 		
-	//dsi_write(dsi, DSI_VIDEO_MODE_FORMAT_REG, BURST_MODE);
-	dsi_write(dsi, DSI_VIDEO_MODE_FORMAT_REG, NON_BURST_WITH_SYNC_PULSES); 
-	dsi_write(dsi, DSI_CLK_EOT_REG, DISABLE_VIDEO_BTA);
-	//dsi_write(dsi, DSI_CLK_EOT_REG, ENABLE_VIDEO_BTA);
-	dsi_write(dsi, DSI_AUTO_ERR_REC_REG, ECC_MUL_ERR_CLR);
+	other_bits = 0u | BIT(11) | BIT(12) | BIT(13) | BIT(16) | BIT(18) | BIT(20) | BIT(21);
+	return (l_div_ratio >> 1) | ((l_div_ratio & 0x01) << 6) | other_bits;
+  	/*buf_reg = DSICONTROLLER->TRIM_REG1;
+	buf_reg = SET_DSI_CONTROLLER_MODEL_TRIM_REG1_CNT_A(buf_reg, l_div_ratio >> 1);
+	buf_reg = SET_DSI_CONTROLLER_MODEL_TRIM_REG1_CNT_B(buf_reg, l_div_ratio & 0x01);
+	DSICONTROLLER->TRIM_REG1 = buf_reg;*/
+}
+
+/* Регистр контроллера и значение, которое ему назначает драйвер */
+struct elv_dsi_reg {
+	u32 reg;
+	u32 val;
+};
+
+#define DSI_LINK_REGS_NR		18
+
+/* Расчёт режима линка и рабочей точки PLL для elv_mipi_dsi_link_regs() */
+static int elv_mipi_dsi_calc_link(struct elv_mipi_dsi *dsi)
+{
+	int ret;
+	
+	elv_mipi_dsi_calc_config(dsi);
+	ret = elv_mipi_dsi_ddr_clk_calc(dsi);
+	elv_mipi_dsi_calc_dpi_resolution(dsi);
+	elv_mipi_dsi_calc_dphy_timings(&to_dsi_priv(dsi)->timings);
+	return ret;
+}
+
+/*
+ * Регистры, которые зависят от режима линка и рабочей точки PLL: их
+ * пишут init и reprogram, и по этому же списку handoff сверяет
+ * конфигурацию загрузчика.
+ */
+static void elv_mipi_dsi_link_regs(struct elv_mipi_dsi *dsi, struct elv_dsi_reg *r)
+{
+	struct mipi_dsi_config *dsi_config = &dsi->dsi_config;
+	struct elv_dsi_timings *t = &to_dsi_priv(dsi)->timings;
+	const struct elv_dsi_reg regs[DSI_LINK_REGS_NR] = {
+		{ DSI_FUNC_PRG_REG,		elv_mipi_dsi_calc_config(dsi) },
+		{ DSI_VIDEO_MODE_FORMAT_REG,	elv_mipi_dsi_video_mode_format(dsi) },
+		{ DSI_CLK_EOT_REG,		elv_mipi_dsi_clk_eot(dsi, false) },
+		{ DSI_DPI_RESOLUTION_REG,	elv_mipi_dsi_dpi_resolution(dsi) },
+		{ DSI_HSYNC_COUNT_REG,		t->hsync },
+		{ DSI_HORIZ_BACK_PORCH_COUNT_REG, t->hbp },
+		{ DSI_HORIZ_FRONT_PORCH_COUNT_REG, t->hfp },
+		{ DSI_HORIZ_ACTIVE_AREA_COUNT_REG, t->haa },
+		{ DSI_VSYNC_COUNT_REG,		dsi_config->VSYNC_count },
+		{ DSI_VERT_BACK_PORCH_COUNT_REG, dsi_max(dsi_config->VSYNC_bpc, VSYNC_bpc_min) },
+		{ DSI_VERT_FRONT_PORCH_COUNT_REG, dsi_max(dsi_config->VSYNC_fpc, VSYNC_fpc_min) },
+		{ DSI_DPHY_PARAM_REG,		elv_mipi_dsi_dphy_param(t) },
+		{ DSI_CLK_LANE_TIMING_PARAM_REG, t->cln_prep | (t->cln_zero << 8) |
+						 (t->cln_hs_trail << 16) | (t->cln_hs_exit << 24) },
+		{ DSI_LP_BYTECLK_REG,		t->lp_byteclk },
+		{ DSI_HIGH_LOW_SWITCH_COUNT_REG, t->high_ls_count },
+		{ DSI_CLK_LANE_SWT_REG,		t->hs_to_lp | (t->lp_to_hs << 16) },
+		{ DSI_TURN_AROUND_TIMEOUT_REG,	t->ta_timeout },
+		{ DSI_TRIM1_REG,		elv_mipi_dsi_trim1(dsi) },
+	};
+	
+	memcpy(r, regs, sizeof(regs));
+}
+
+static void elv_mipi_dsi_write_link(struct elv_mipi_dsi *dsi)
+{
+	struct elv_dsi_reg regs[DSI_LINK_REGS_NR];
+	int i;
+	
+	elv_mipi_dsi_link_regs(dsi, regs);
+	for (i = 0; i < DSI_LINK_REGS_NR; i++)
+		dsi_write(dsi, regs[i].reg, regs[i].val);
+}
+
+static void elv_mipi_dsi_start_dsi(struct elv_mipi_dsi *dsi)
+{
+	dsi_write(dsi, DSI_RST_ENABLE_DFE_REG, DFE_RST_ENABLE);
+	dsi_write(dsi, DSI_DEVICE_READY_REG, DEVICE_ENABLE);
+	elv_mipi_dsi_dpi_control(dsi, TURN_ON_PERIPHERAL);  // Добавлено для корректной работы DSI контроллера в Linux после его использования в u-boot
+}
+
+/* Снимок берётся из кэша regmap, без обращений к шине */
+static void elv_mipi_dsi_save_context(struct elv_mipi_dsi *dsi)
+{
+	struct elv_mipi_dsi_priv *priv = to_dsi_priv(dsi);
+	int i;
+	
+	for (i = 0; i < ARRAY_SIZE(elv_dsi_ctx_regs); i++)
+		priv->ctx[i] = dsi_read(dsi, elv_dsi_ctx_regs[i]);
+	priv->ctx_valid = true;
+}
+
+/*
+ * После снятия питания регистры возвращаются к значениям сброса; это
+ * видно по FUNC_PRG и TRIM1. Тогда контекст записывается одним проходом
+ * в порядке elv_dsi_ctx_regs (PLL первым) и линк запускается заново со
+ * сбросом DFE. regmap_write() пишет на шину всегда, даже если кэш уже
+ * содержит это значение. Возвращает true, если восстановление выполнено.
+ */
+static bool elv_mipi_dsi_restore_context(struct elv_mipi_dsi *dsi)
+{
+	struct elv_mipi_dsi_priv *priv = to_dsi_priv(dsi);
+	struct elv_dsi_cost cost;
+	bool lost = false;
+	ktime_t start;
+	int i;
+	
+	if (!priv->ctx_valid)
+		return false;
+	
+	for (i = 0; i < ARRAY_SIZE(elv_dsi_ctx_regs); i++)
+		if ((elv_dsi_ctx_regs[i] == DSI_FUNC_PRG_REG ||
+		     elv_dsi_ctx_regs[i] == DSI_TRIM1_REG) &&
+		    dsi_read_hw(dsi, elv_dsi_ctx_regs[i]) != priv->ctx[i])
+			lost = true;
+	if (!lost)
+		return false;
+	
+	cost = dsi_seq_start(priv);
+	start = ktime_get();
+	for (i = 0; i < ARRAY_SIZE(elv_dsi_ctx_regs); i++)
+		regmap_write(priv->map, elv_dsi_ctx_regs[i], priv->ctx[i]);
+	elv_mipi_dsi_start_dsi(dsi);
+	elv_mipi_dsi_turn_on(dsi);
+	
+	priv->ctx_restore_us = ktime_us_delta(ktime_get(), start);
+	priv->ctx_restores++;
+	dsi_seq_end(priv, DSI_SEQ_RESTORE, cost);
+	return true;
+}
+
+/*
+ * Если u-boot уже запустил линк в нужном режиме (показывает заставку),
+ * конфигурация принимается как есть: все регистры линка из
+ * elv_mipi_dsi_link_regs() сравниваются с пересчитанными значениями, и при
+ * полном совпадении линк не трогается.
+ */
+static bool elv_mipi_dsi_handoff(struct elv_mipi_dsi *dsi)
+{
+	struct elv_dsi_reg regs[DSI_LINK_REGS_NR];
+	u32 ready = dsi_read_hw(dsi, DSI_DEVICE_READY_REG);
+	int i;
+	
+	if (!(ready & DEVICE_ENABLE) ||
+	    (ready & DSI_DEVICE_MODE_MASK) != DEVICE_NORMAL_MODE)
+		return false;
+	
+	elv_mipi_dsi_calc_link(dsi);
+	elv_mipi_dsi_link_regs(dsi, regs);
+	for (i = 0; i < DSI_LINK_REGS_NR; i++)
+		if (dsi_read_hw(dsi, regs[i].reg) != regs[i].val)
+			return false;
+	
+	elv_mipi_dsi_config_irq(dsi);
+	dsi->ulp_mode = 0;
+	elv_mipi_dsi_save_context(dsi);
+	return true;
+}
+
+/* Возвращает true, если принята конфигурация загрузчика */
+static bool elv_mipi_dsi_init_dsi(struct elv_mipi_dsi *dsi)
+{	
+	if (elv_mipi_dsi_handoff(dsi))
+		return true;
+	
+	// Добавлено для корректной работы DSI контроллера в Linux после его использования в u-boot	
+	if (elv_mipi_dsi_is_enable(dsi))
+		elv_mipi_dsi_disable(dsi); 
+	
+	/*
+	 * Кэш заполнен значениями из контроллера при probe, поэтому на шину
+	 * уходят только регистры, значение которых отличается
+	 */
+	elv_mipi_dsi_config_irq(dsi);
+	elv_mipi_dsi_set_base_timings(dsi);
+	elv_mipi_dsi_calc_link(dsi);
+	elv_mipi_dsi_write_link(dsi);
+	
+	elv_mipi_dsi_start_dsi(dsi);
+	elv_mipi_dsi_turn_on(dsi);
+	elv_mipi_dsi_save_context(dsi);
+	return false;
+}
+
+static u32 elv_mipi_dsi_frame_size(struct videomode *vm)
+{
+	return (vm->hactive + vm->hfront_porch + vm->hback_porch + vm->hsync_len) *
+		(vm->vactive + vm->vfront_porch + vm->vback_porch + vm->vsync_len);
+}
+
+/* Счётчики DPI: их контроллер подхватывает на следующем кадре */
+static bool elv_mipi_dsi_dpi_count_reg(u32 reg)
+{
+	switch (reg) {
+	case DSI_DPI_RESOLUTION_REG:
+	case DSI_HSYNC_COUNT_REG:
+	case DSI_HORIZ_BACK_PORCH_COUNT_REG:
+	case DSI_HORIZ_FRONT_PORCH_COUNT_REG:
+	case DSI_HORIZ_ACTIVE_AREA_COUNT_REG:
+	case DSI_VSYNC_COUNT_REG:
+	case DSI_VERT_BACK_PORCH_COUNT_REG:
+	case DSI_VERT_FRONT_PORCH_COUNT_REG:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/*
+ * Меняется ли что-то кроме счётчиков DPI: PLL (TRIM1), параметры D-PHY,
+ * режим линка. Сравнение идёт с кэшем regmap, без обращений к шине.
+ */
+static bool elv_mipi_dsi_link_changed(struct elv_mipi_dsi *dsi)
+{
+	struct elv_dsi_reg regs[DSI_LINK_REGS_NR];
+	int i;
+	
+	elv_mipi_dsi_link_regs(dsi, regs);
+	for (i = 0; i < DSI_LINK_REGS_NR; i++)
+		if (!elv_mipi_dsi_dpi_count_reg(regs[i].reg) &&
+		    dsi_read(dsi, regs[i].reg) != regs[i].val)
+			return true;
+	return false;
+}
+
+/*
+ * Перепрограммирование линка под текущие priv->vm, число линий и формат
+ * без повторного probe. Если меняются только счётчики DPI, работающий
+ * линк на время записи переводится в LP (ULPS без пакета shutdown
+ * peripheral) и панель держит последний кадр. Новый делитель PLL и
+ * тайминги D-PHY, как при init, записываются в выключенный контроллер
+ * с последующим сбросом DFE. Записываются только изменившиеся регистры.
+ * Линк, который уже был в ULPS (в том числе вручную через ulp_mode), в
+ * нём и остаётся. Выключенный контроллер (recover, set_mode)
+ * запускается заново.
+ */
+static void elv_mipi_dsi_reprogram(struct elv_mipi_dsi *dsi)
+{
+	struct elv_dsi_cost cost = dsi_seq_start(to_dsi_priv(dsi));
+	bool ulps = dsi->ulp_mode;
+	bool enabled;
+	
+	if (elv_mipi_dsi_dphy_clk_on(dsi))
+		return;
+	
+	enabled = elv_mipi_dsi_is_enable(dsi);
+	elv_mipi_dsi_calc_link(dsi);
+	
+	if (!enabled || elv_mipi_dsi_link_changed(dsi)) {
+		if (enabled)
+			elv_mipi_dsi_disable(dsi);
+		elv_mipi_dsi_config_irq(dsi);
+		elv_mipi_dsi_write_link(dsi);
+		elv_mipi_dsi_start_dsi(dsi);
+		elv_mipi_dsi_turn_on(dsi);
+		if (enabled && ulps)
+			elv_mipi_dsi_ulp_mode(dsi);
+		goto out;
+	}
+	
+	if (!ulps) {
+		dsi_write(dsi, DSI_DEVICE_READY_REG, (DEVICE_ULP_MODE | DEVICE_ENABLE));
+		usleep_range(DSI_ULPS_ENTER_US, DSI_ULPS_ENTER_US + 50);
+	}
+	
+	elv_mipi_dsi_config_irq(dsi);
+	elv_mipi_dsi_write_link(dsi);
+	
+	if (!ulps) {
+		dsi_write(dsi, DSI_DEVICE_READY_REG, (DEVICE_EXIT_MODE | DEVICE_ENABLE));
+		usleep_range(DSI_ULPS_WAKEUP_US, DSI_ULPS_WAKEUP_US + 500);
+		dsi_write(dsi, DSI_DEVICE_READY_REG, (DEVICE_NORMAL_MODE | DEVICE_ENABLE));
+	} else {
+		elv_mipi_dsi_dphy_clk_off(dsi);
+	}
+out:
+	elv_mipi_dsi_save_context(dsi);
+	dsi_seq_end(to_dsi_priv(dsi), DSI_SEQ_REPROGRAM, cost);
+}
+
+/*
+ * Смена частоты кадров: pixclk видеовыхода перестраивается через clk API,
+ * тайминги DPI, D-PHY и коэффициент PLL пересчитываются под новую частоту.
+ * Без клока "pclk" в DT частоту pixclk изменить нельзя.
+ */
+static int elv_mipi_dsi_set_refresh_rate(struct elv_mipi_dsi *dsi, u32 fps)
+{
+	struct elv_mipi_dsi_priv *priv = to_dsi_priv(dsi);
+	int ret = 0;
+	
+	if (!priv->pclk)
+		return -EOPNOTSUPP;
+	if (fps == 0 || fps > priv->refresh_max)
+		return -EINVAL;
+	
+	pm_runtime_get_sync(dsi->dev);
+	mutex_lock(&priv->lock);
+	
+	if (fps == priv->refresh)
+		goto out;
+	
+	ret = clk_set_rate(priv->pclk, elv_mipi_dsi_frame_size(&priv->vm) * fps);
+	if (ret) {
+		dev_err(dsi->dev, "Failed to set pixel clock for %u Hz: %d\n", fps, ret);
+		goto out;
+	}
+	
+	priv->vm.pixelclock = clk_get_rate(priv->pclk);
+	elv_mipi_dsi_reprogram(dsi);
+	priv->refresh = fps;
+	
+out:
+	mutex_unlock(&priv->lock);
+	pm_runtime_mark_last_busy(dsi->dev);
+	pm_runtime_put_autosuspend(dsi->dev);
+	return ret;
+}
+
+/*
+ * Смена режима линка без перезагрузки драйвера: номер режима из
+ * display-timings, число линий, формат пикселя и burst. Новый режим
+ * сначала проверяется расчётом рабочей точки PLL, и при ошибке всё
+ * остаётся как было. Затем линк останавливается через ULPS, выключается
+ * (число линий и формат меняются только со сбросом DFE),
+ * перепрограммируется и запускается заново. Частота кадров
+ * возвращается к номинальной для нового режима.
+ */
+static int elv_mipi_dsi_set_mode(struct elv_mipi_dsi *dsi, u32 timing, u32 lanes,
+				 const struct elv_dsi_format *format, bool burst)
+{
+	struct elv_mipi_dsi_priv *priv = to_dsi_priv(dsi);
+	const struct elv_dsi_format *old_format;
+	struct elv_dsi_timings old_timings;
+	struct mipi_dsi_config old_config;
+	struct videomode vm, old_vm;
+	u32 old_lanes;
+	bool old_burst, quiesced = false;
+	ktime_t start;
+	int ret;
+	
+	if (lanes == 0 || lanes > 4)
+		return -EINVAL;
+	
+	if (priv->disp) {
+		if (timing >= priv->disp->num_timings)
+			return -EINVAL;
+		ret = videomode_from_timings(priv->disp, &vm, timing);
+		if (ret)
+			return ret;
+	} else {
+		if (timing)
+			return -EINVAL;
+		vm = elv_dsi_default_vm;
+	}
+	
+	pm_runtime_get_sync(dsi->dev);
+	mutex_lock(&priv->lock);
+	start = ktime_get();
+	
+	old_vm = priv->vm;
+	old_lanes = priv->lanes;
+	old_format = priv->format;
+	old_burst = priv->burst_mode;
+	old_timings = priv->timings;
+	old_config = dsi->dsi_config;
+	
+	priv->vm = vm;
+	priv->lanes = lanes;
+	priv->format = format;
+	priv->burst_mode = burst;
+	elv_mipi_dsi_calc_config(dsi);
+	ret = elv_mipi_dsi_ddr_clk_calc(dsi);
+	if (ret)
+		goto restore;
+	
+	if (!dsi->ulp_mode)
+		elv_mipi_dsi_ulp_mode(dsi);
+	elv_mipi_dsi_disable(dsi);
+	quiesced = true;
+	
+	if (priv->pclk && vm.pixelclock) {
+		ret = clk_set_rate(priv->pclk, vm.pixelclock);
+		if (ret) {
+			dev_err(dsi->dev, "Failed to set pixel clock %lu Hz: %d\n",
+				vm.pixelclock, ret);
+			goto restore;
+		}
+		priv->vm.pixelclock = clk_get_rate(priv->pclk);
+	}
+	
+	elv_mipi_dsi_reprogram(dsi);
+	priv->timing = timing;
+	priv->refresh_max = DIV_ROUND_CLOSEST(priv->timings.pclk_khz * 1000,
+					      elv_mipi_dsi_frame_size(&priv->vm));
+	priv->refresh = priv->refresh_max;
+	priv->reconfigs++;
+	priv->reconfig_us = ktime_us_delta(ktime_get(), start);
+	dev_info(dsi->dev, "Mode %ux%u, %u lanes, %s, %s video mode, ddr_clk %u MHz in %u us\n",
+		 priv->vm.hactive, priv->vm.vactive, lanes, format->name,
+		 burst ? "burst" : "non-burst", priv->timings.ddr_mhz, priv->reconfig_us);
+	goto out;
+	
+restore:
+	priv->vm = old_vm;
+	priv->lanes = old_lanes;
+	priv->format = old_format;
+	priv->burst_mode = old_burst;
+	priv->timings = old_timings;
+	dsi->dsi_config = old_config;
+	/* Линк уже остановлен, запускаем его в прежнем режиме */
+	if (quiesced)
+		elv_mipi_dsi_reprogram(dsi);
+out:
+	mutex_unlock(&priv->lock);
+	pm_runtime_mark_last_busy(dsi->dev);
+	pm_runtime_put_autosuspend(dsi->dev);
+	return ret;
+}
+
+static void elv_mipi_dsi_idle_work(struct work_struct *work)
+{
+	struct elv_mipi_dsi_priv *priv = container_of(to_delayed_work(work),
+					struct elv_mipi_dsi_priv, idle_work);
+	unsigned long timeout = msecs_to_jiffies(priv->idle_timeout_ms);
+	
+	if (!priv->pclk || !priv->idle_timeout_ms || !priv->idle_refresh)
+		return;
+	
+	/* Линк уже в ULPS, перестраивать частоту незачем */
+	if (pm_runtime_suspended(priv->dsi.dev))
+		return;
+	
+	/* Обновление пришло, пока работа стояла в очереди */
+	if (time_before(jiffies, priv->last_activity + timeout)) {
+		mod_delayed_work(system_wq, &priv->idle_work,
+				 priv->last_activity + timeout - jiffies);
+		return;
+	}
+	
+	elv_mipi_dsi_set_refresh_rate(&priv->dsi, priv->idle_refresh);
+}
+
+static void elv_mipi_dsi_wake_work(struct work_struct *work)
+{
+	struct elv_mipi_dsi_priv *priv = container_of(work,
+					struct elv_mipi_dsi_priv, wake_work);
+	
+	elv_mipi_dsi_set_refresh_rate(&priv->dsi, priv->refresh_max);
+	
+	if (priv->idle_timeout_ms)
+		mod_delayed_work(system_wq, &priv->idle_work,
+				 msecs_to_jiffies(priv->idle_timeout_ms));
+}
+
+/*
+ * Вызывается драйвером видеовыхода при каждом обновлении framebuffer.
+ * Возвращает линк на полную частоту кадров и перезапускает таймер простоя,
+ * по истечении которого частота снижается до idle_refresh, а также таймер
+ * autosuspend, после которого линк уходит в ULPS с выключенным dphy_clk.
+ * Может вызываться из атомарного контекста.
+ */
+void elv_mipi_dsi_frame_activity(struct elv_mipi_dsi *dsi)
+{
+	struct elv_mipi_dsi_priv *priv = to_dsi_priv(dsi);
+	
+	priv->last_activity = jiffies;
+	
+	/* Выход из ULPS при первом кадре после autosuspend, асинхронно */
+	pm_runtime_get(dsi->dev);
+	pm_runtime_mark_last_busy(dsi->dev);
+	pm_runtime_put_autosuspend(dsi->dev);
+	
+	if (priv->refresh != priv->refresh_max)
+		schedule_work(&priv->wake_work);
+	else if (priv->idle_timeout_ms)
+		mod_delayed_work(system_wq, &priv->idle_work,
+				 msecs_to_jiffies(priv->idle_timeout_ms));
+}
+EXPORT_SYMBOL_GPL(elv_mipi_dsi_frame_activity);
+
+/*
+ * Событие кадра. В командном режиме источник - TE панели, в видеорежиме
+ * контроллер DSI прерывания по кадру не формирует, и функцию вызывает
+ * драйвер видеовыхода из своего прерывания VSYNC. Может вызываться из
+ * атомарного контекста.
+ */
+void elv_mipi_dsi_vblank(struct elv_mipi_dsi *dsi)
+{
+	struct elv_mipi_dsi_priv *priv = to_dsi_priv(dsi);
+	unsigned long flags;
+	
+	spin_lock_irqsave(&priv->vblank_lock, flags);
+	priv->vblank_count++;
+	priv->vblank_ts = ktime_get();
+	spin_unlock_irqrestore(&priv->vblank_lock, flags);
+	
+	if (trace_elv_dsi_frame_enabled())
+		trace_elv_dsi_frame(priv->vblank_count, dsi_frame_bytes(priv),
+				    dsi_link_util(priv));
+	
+	wake_up_all(&priv->vblank_wait);
+	if (priv->vblank_kn)
+		sysfs_notify_dirent(priv->vblank_kn);
+}
+EXPORT_SYMBOL_GPL(elv_mipi_dsi_vblank);
+
+/*
+ * Ожидание следующего события кадра, например для FBIO_WAITFORVSYNC
+ * драйвера видеовыхода. Возвращает 0, -ETIMEDOUT или -ERESTARTSYS.
+ */
+int elv_mipi_dsi_wait_vblank(struct elv_mipi_dsi *dsi, unsigned int timeout_ms)
+{
+	struct elv_mipi_dsi_priv *priv = to_dsi_priv(dsi);
+	u32 count = READ_ONCE(priv->vblank_count);
+	long ret;
+	
+	ret = wait_event_interruptible_timeout(priv->vblank_wait,
+			READ_ONCE(priv->vblank_count) != count,
+			msecs_to_jiffies(timeout_ms));
+	if (ret < 0)
+		return ret;
+	return ret ? 0 : -ETIMEDOUT;
+}
+EXPORT_SYMBOL_GPL(elv_mipi_dsi_wait_vblank);
+
+static void elv_mipi_dsi_init_refresh(struct elv_mipi_dsi *dsi)
+{
+	struct elv_mipi_dsi_priv *priv = to_dsi_priv(dsi);
+	
+	priv->refresh_max = DIV_ROUND_CLOSEST(priv->timings.pclk_khz * 1000,
+					      elv_mipi_dsi_frame_size(&priv->vm));
+	priv->refresh = priv->refresh_max;
+	priv->last_activity = jiffies;
+	
+	/* Таймер простоя запускает probe последним, см. elv_mipi_dsi_probe() */
+	INIT_DELAYED_WORK(&priv->idle_work, elv_mipi_dsi_idle_work);
+	INIT_WORK(&priv->wake_work, elv_mipi_dsi_wake_work);
+}
+
+static const struct elv_dsi_format *elv_mipi_dsi_find_format(const char *name)
+{
+	int i;
+	
+	for (i = 0; i < ARRAY_SIZE(elv_dsi_formats); i++)
+		if (!strcmp(elv_dsi_formats[i].name, name))
+			return &elv_dsi_formats[i];
+	
+	return NULL;
+}
+
+static void elv_mipi_dsi_release_timings(void *disp)
+{
+	display_timings_release(disp);
+}
+
+static int elv_mipi_dsi_parse_dt(struct elv_mipi_dsi *dsi)
+{
+	struct elv_mipi_dsi_priv *priv = to_dsi_priv(dsi);
+	struct device_node *np = dsi->dev->of_node;
+	struct device_node *timings_np;
+	const char *format = "rgb888";
+	int ret;
+	
+	priv->burst_mode = of_property_read_bool(np, "elvees,burst-mode");
+	priv->cmd_mode = of_property_read_bool(np, "elvees,command-mode");
+	priv->clk_noncont = of_property_read_bool(np, "elvees,non-continuous-clock");
+	
+	of_property_read_u32(np, "elvees,video-channel", &priv->video_vc);
+	if (priv->video_vc > 3) {
+		dev_err(dsi->dev, "Invalid elvees,video-channel: %u\n", priv->video_vc);
+		return -EINVAL;
+	}
+	
+	priv->idle_refresh = 30;
+	of_property_read_u32(np, "elvees,idle-refresh-rate", &priv->idle_refresh);
+	of_property_read_u32(np, "elvees,idle-timeout-ms", &priv->idle_timeout_ms);
+	
+	priv->link_interval_ms = 1000;
+	priv->link_threshold = 10;
+	of_property_read_u32(np, "elvees,link-monitor-ms", &priv->link_interval_ms);
+	of_property_read_u32(np, "elvees,link-error-threshold", &priv->link_threshold);
+	
+	/* data-lanes - список номеров линий, важно только их число */
+	priv->lanes = 2;
+	ret = of_property_count_u32_elems(np, "data-lanes");
+	if (ret > 0)
+		priv->lanes = ret;
+	if (priv->lanes > 4) {
+		dev_err(dsi->dev, "Invalid data-lanes: %u\n", priv->lanes);
+		return -EINVAL;
+	}
+	
+	of_property_read_string(np, "pixel-format", &format);
+	priv->format = elv_mipi_dsi_find_format(format);
+	if (!priv->format) {
+		dev_err(dsi->dev, "Invalid pixel-format: %s\n", format);
+		return -EINVAL;
+	}
+	
+	/* Без display-timings работаем в режиме 480x800 по умолчанию */
+	priv->vm = elv_dsi_default_vm;
+	timings_np = of_get_child_by_name(np, "display-timings");
+	if (!timings_np)
+		return 0;
+	of_node_put(timings_np);
+	
+	priv->disp = of_get_display_timings(np);
+	if (!priv->disp) {
+		dev_err(dsi->dev, "Failed to parse display-timings\n");
+		return -EINVAL;
+	}
+	
+	/* Режимы освобождаются вместе с priv, в том числе при ошибке probe */
+	ret = devm_add_action(dsi->dev, elv_mipi_dsi_release_timings, priv->disp);
+	if (ret) {
+		display_timings_release(priv->disp);
+		priv->disp = NULL;
+		return ret;
+	}
+	
+	priv->timing = priv->disp->native_mode;
+	ret = videomode_from_timings(priv->disp, &priv->vm, priv->timing);
+	if (ret) {
+		dev_err(dsi->dev, "Failed to get native mode: %d\n", ret);
+		return ret;
+	}
+	
+	return 0;
+}
+
+/*
+ * Восстановление линка после фатальной ошибки: сброс DFE и перезапуск
+ * с текущими настройками. Не чаще раза в DSI_RECOVER_INTERVAL_MS, чтобы
+ * постоянная ошибка не превращалась в непрерывный перезапуск: ошибка
+ * внутри интервала откладывает восстановление до его конца, а не
+ * теряется.
+ */
+static void elv_mipi_dsi_recover_work(struct work_struct *work)
+{
+	struct elv_mipi_dsi_priv *priv = container_of(to_delayed_work(work),
+					struct elv_mipi_dsi_priv, recover_work);
+	struct elv_mipi_dsi *dsi = &priv->dsi;
+	unsigned long next = priv->recover_last +
+			     msecs_to_jiffies(DSI_RECOVER_INTERVAL_MS);
+	
+	if (priv->recoveries && time_before(jiffies, next)) {
+		schedule_delayed_work(&priv->recover_work, next - jiffies);
+		return;
+	}
+	
+	pm_runtime_get_sync(dsi->dev);
+	mutex_lock(&priv->lock);
+	if (!dsi->ulp_mode) {
+		elv_mipi_dsi_disable(dsi);
+		elv_mipi_dsi_reprogram(dsi);
+		priv->recoveries++;
+		priv->recover_last = jiffies;
+		dev_warn(dsi->dev, "Link restarted after fatal error (%u)\n",
+			 priv->recoveries);
+	}
+	mutex_unlock(&priv->lock);
+	pm_runtime_put_autosuspend(dsi->dev);
+}
+
+static u32 dsi_link_errors(struct elv_mipi_dsi_priv *priv)
+{
+	unsigned long mask = DSI_INT_LINK_ERRORS;
+	u32 sum = 0;
+	int bit;
+	
+	for_each_set_bit(bit, &mask, 32)
+		sum += atomic_read(&priv->irq_count[bit]);
+	return sum;
+}
+
+/*
+ * Контроль качества линка. Раз в link_interval_ms по счётчикам прерываний
+ * считаются ошибки ECC/CRC/SoT за интервал. Если их больше link_threshold,
+ * уровень запаса повышается: делитель PLL снижается на шаг, если поток
+ * пикселей это позволяет, а интервалы D-PHY удлиняются ещё на
+ * DSI_LINK_MARGIN_PCT % (см. elv_mipi_dsi_pll_conservative()). После
+ * DSI_LINK_CLEAN_INTERVALS интервалов подряд без ошибок уровень
+ * понижается на один. В ULPS и runtime suspend ошибок нет, такие
+ * интервалы не учитываются.
+ */
+static void elv_mipi_dsi_link_work(struct work_struct *work)
+{
+	struct elv_mipi_dsi_priv *priv = container_of(to_delayed_work(work),
+					struct elv_mipi_dsi_priv, link_work);
+	struct elv_mipi_dsi *dsi = &priv->dsi;
+	u32 errors = dsi_link_errors(priv);
+	u32 level = priv->link_level;
+	
+	priv->link_rate = errors - priv->link_errors_last;
+	priv->link_errors_last = errors;
+	
+	if (pm_runtime_suspended(dsi->dev) || dsi->ulp_mode)
+		goto out;
+	
+	if (priv->link_rate > priv->link_threshold) {
+		priv->link_clean = 0;
+		if (level < DSI_LINK_LEVELS - 1)
+			level++;
+	} else if (priv->link_rate) {
+		priv->link_clean = 0;
+	} else if (level && ++priv->link_clean >= DSI_LINK_CLEAN_INTERVALS) {
+		priv->link_clean = 0;
+		level--;
+	}
+	
+	if (level == priv->link_level)
+		goto out;
+	
+	pm_runtime_get_sync(dsi->dev);
+	mutex_lock(&priv->lock);
+	if (!dsi->ulp_mode) {
+		if (level > priv->link_level)
+			priv->link_steps_up++;
+		else
+			priv->link_steps_down++;
+		priv->link_level = level;
+		elv_mipi_dsi_reprogram(dsi);
+		dev_warn(dsi->dev, "Link level %u after %u errors in %u ms: ddr_clk %u MHz, D-PHY margin +%u%%\n",
+			 level, priv->link_rate, priv->link_interval_ms,
+			 priv->timings.ddr_mhz, priv->timings.margin_pct);
+	}
+	mutex_unlock(&priv->lock);
+	pm_runtime_mark_last_busy(dsi->dev);
+	pm_runtime_put_autosuspend(dsi->dev);
+	
+out:
+	schedule_delayed_work(&priv->link_work,
+			      msecs_to_jiffies(priv->link_interval_ms));
+}
+
+static irqreturn_t dsi_irq_handler(int irq, void *dev_id)
+{
+	struct elv_mipi_dsi *dsi = (struct elv_mipi_dsi *)dev_id;
+	struct elv_mipi_dsi_priv *priv = to_dsi_priv(dsi);
+	unsigned long pending;
+	u32 irqstatus;
+	int bit;
+
+	irqstatus = dsi_read(dsi, DSI_IRQ_STATUS_REG);
+	if (!irqstatus)
+		return IRQ_NONE;
+	
+	pending = irqstatus;
+	for_each_set_bit(bit, &pending, 32)
+		atomic_inc(&priv->irq_count[bit]);
+
+	/* Ошибка, пришедшая до запуска восстановления, в нём и учтётся */
+	if ((irqstatus & DSI_INT_FATAL & elv_mipi_dsi_irq_mask(priv)) &&
+	    !schedule_delayed_work(&priv->recover_work, 0))
+		priv->recover_skipped++;
+	
+	if (irqstatus & DSI_READ_DONE) {
+		priv->read_status |= irqstatus & DSI_READ_DONE;
+		complete(&priv->read_done);
+	}
+	
+	dsi_write(dsi, DSI_IRQ_STATUS_REG, irqstatus);
+
+	return IRQ_HANDLED;
+}
+
+static ssize_t elv_mipi_dsi_refresh_rate_show(struct device *dev,
+        struct device_attribute *attr, char *buf)
+{
+    struct elv_mipi_dsi *dsi = dev_get_drvdata(dev);
+
+    return sprintf(buf, "%u\n", to_dsi_priv(dsi)->refresh);
+}
+
+static ssize_t elv_mipi_dsi_refresh_rate_store(struct device *dev,
+        struct device_attribute *attr, const char *buf, size_t count)
+{
+    struct elv_mipi_dsi *dsi = dev_get_drvdata(dev);
+    int ret;
+    u32 val;
+
+    ret = kstrtou32(buf, 10, &val);
+    if (ret)
+		return ret;
+	
+	ret = elv_mipi_dsi_set_refresh_rate(dsi, val);
+	if (ret)
+		return ret;
+			
+    return count;
+}
+
+static DEVICE_ATTR(refresh_rate, S_IRUGO | S_IWUSR, elv_mipi_dsi_refresh_rate_show,
+                   elv_mipi_dsi_refresh_rate_store);
+
+static ssize_t elv_mipi_dsi_idle_refresh_rate_show(struct device *dev,
+        struct device_attribute *attr, char *buf)
+{
+    struct elv_mipi_dsi *dsi = dev_get_drvdata(dev);
+
+    return sprintf(buf, "%u\n", to_dsi_priv(dsi)->idle_refresh);
+}
+
+static ssize_t elv_mipi_dsi_idle_refresh_rate_store(struct device *dev,
+        struct device_attribute *attr, const char *buf, size_t count)
+{
+    struct elv_mipi_dsi_priv *priv = to_dsi_priv(dev_get_drvdata(dev));
+    int ret;
+    u32 val;
+
+    ret = kstrtou32(buf, 10, &val);
+    if (ret)
+		return ret;
+	
+	if (val > priv->refresh_max)
+		return -EINVAL;
+	
+	priv->idle_refresh = val;
+    return count;
+}
+
+static DEVICE_ATTR(idle_refresh_rate, S_IRUGO | S_IWUSR, elv_mipi_dsi_idle_refresh_rate_show,
+                   elv_mipi_dsi_idle_refresh_rate_store);
+
+static ssize_t elv_mipi_dsi_idle_timeout_ms_show(struct device *dev,
+        struct device_attribute *attr, char *buf)
+{
+    struct elv_mipi_dsi *dsi = dev_get_drvdata(dev);
+
+    return sprintf(buf, "%u\n", to_dsi_priv(dsi)->idle_timeout_ms);
+}
+
+static ssize_t elv_mipi_dsi_idle_timeout_ms_store(struct device *dev,
+        struct device_attribute *attr, const char *buf, size_t count)
+{
+    struct elv_mipi_dsi *dsi = dev_get_drvdata(dev);
+    int ret;
+    u32 val;
+
+    ret = kstrtou32(buf, 10, &val);
+    if (ret)
+		return ret;
+	
+	to_dsi_priv(dsi)->idle_timeout_ms = val;
+	elv_mipi_dsi_frame_activity(dsi);
+    return count;
+}
+
+static DEVICE_ATTR(idle_timeout_ms, S_IRUGO | S_IWUSR, elv_mipi_dsi_idle_timeout_ms_show,
+                   elv_mipi_dsi_idle_timeout_ms_store);
+
+/* "timing=N lanes=N format=NAME burst=0|1", при записи можно задать часть полей */
+static ssize_t elv_mipi_dsi_mode_show(struct device *dev,
+        struct device_attribute *attr, char *buf)
+{
+    struct elv_mipi_dsi_priv *priv = to_dsi_priv(dev_get_drvdata(dev));
+    ssize_t len;
+
+    mutex_lock(&priv->lock);
+    len = sprintf(buf, "timing=%u lanes=%u format=%s burst=%u\n", priv->timing,
+                  priv->lanes, priv->format->name, priv->burst_mode);
+    mutex_unlock(&priv->lock);
+
+    return len;
+}
+
+static ssize_t elv_mipi_dsi_mode_store(struct device *dev,
+        struct device_attribute *attr, const char *buf, size_t count)
+{
+    struct elv_mipi_dsi *dsi = dev_get_drvdata(dev);
+    struct elv_mipi_dsi_priv *priv = to_dsi_priv(dsi);
+    const struct elv_dsi_format *format;
+    u32 timing, lanes, burst;
+    char *opts, *p, *opt, *val;
+    int ret = 0;
+
+    mutex_lock(&priv->lock);
+    timing = priv->timing;
+    lanes = priv->lanes;
+    format = priv->format;
+    burst = priv->burst_mode;
+    mutex_unlock(&priv->lock);
+
+    opts = kstrndup(buf, count, GFP_KERNEL);
+    if (!opts)
+        return -ENOMEM;
+
+    p = strim(opts);
+    while ((opt = strsep(&p, " \t")) != NULL) {
+        if (!*opt)
+            continue;
+        val = strchr(opt, '=');
+        if (!val) {
+            ret = -EINVAL;
+            break;
+        }
+        *val++ = '\0';
+
+        if (!strcmp(opt, "timing"))
+            ret = kstrtou32(val, 10, &timing);
+        else if (!strcmp(opt, "lanes"))
+            ret = kstrtou32(val, 10, &lanes);
+        else if (!strcmp(opt, "burst"))
+            ret = kstrtou32(val, 10, &burst);
+        else if (!strcmp(opt, "format")) {
+            format = elv_mipi_dsi_find_format(val);
+            if (!format)
+                ret = -EINVAL;
+        } else
+            ret = -EINVAL;
+        if (ret)
+            break;
+    }
+    kfree(opts);
+
+    if (ret) {
+        dev_err(dev, "Invalid mode string\n");
+        return ret;
+    }
+
+    ret = elv_mipi_dsi_set_mode(dsi, timing, lanes, format, burst);
+    if (ret)
+        return ret;
+
+    return count;
+}
+
+static DEVICE_ATTR(mode, S_IRUGO | S_IWUSR, elv_mipi_dsi_mode_show,
+                   elv_mipi_dsi_mode_store);
+
+static ssize_t elv_mipi_dsi_reconfig_show(struct device *dev,
+        struct device_attribute *attr, char *buf)
+{
+    struct elv_mipi_dsi_priv *priv = to_dsi_priv(dev_get_drvdata(dev));
+
+    return sprintf(buf, "reconfigs %u\nlast %u us\n",
+                   priv->reconfigs, priv->reconfig_us);
+}
+
+static DEVICE_ATTR(reconfig, S_IRUGO, elv_mipi_dsi_reconfig_show, NULL);
+
+static ssize_t elv_mipi_dsi_link_quality_show(struct device *dev,
+        struct device_attribute *attr, char *buf)
+{
+    struct elv_mipi_dsi_priv *priv = to_dsi_priv(dev_get_drvdata(dev));
+
+    return sprintf(buf, "level %u of %u\nerrors %u per %u ms\nthreshold %u\n"
+                   "steps up %u\nsteps down %u\nddr_clk %u MHz\nmargin %u%%\n",
+                   priv->link_level, DSI_LINK_LEVELS - 1, priv->link_rate,
+                   priv->link_interval_ms, priv->link_threshold,
+                   priv->link_steps_up, priv->link_steps_down,
+                   priv->timings.ddr_mhz, priv->timings.margin_pct);
+}
+
+static DEVICE_ATTR(link_quality, S_IRUGO, elv_mipi_dsi_link_quality_show, NULL);
+
+static struct attribute *elv_mipi_dsi_attrs[] = {
+    &dev_attr_ulp_mode.attr,
+    &dev_attr_ulps_latency.attr,
+    &dev_attr_context_restore.attr,
+    &dev_attr_rpm_residency.attr,
+    &dev_attr_vblank.attr,
+    &dev_attr_refresh_rate.attr,
+    &dev_attr_idle_refresh_rate.attr,
+    &dev_attr_idle_timeout_ms.attr,
+    &dev_attr_mode.attr,
+    &dev_attr_reconfig.attr,
+    &dev_attr_link_quality.attr,
+    NULL
+};
+
+static struct attribute_group elv_mipi_dsi_attr_group = {
+    .name = "elv_mipi_dsi",
+    .attrs = elv_mipi_dsi_attrs,
+};
+
+static inline struct elv_mipi_dsi_priv *host_to_dsi_priv(struct mipi_dsi_host *host)
+{
+	return container_of(host, struct elv_mipi_dsi_priv, host);
 }
 
-static void elv_mipi_dsi_set_base_timings(struct elv_mipi_dsi *dsi)
+static int elv_mipi_dsi_wait_fifo(struct elv_mipi_dsi *dsi, u32 mask, u32 want)
 {
-	dsi_write(dsi, DSI_HS_TX_TIMEOUT_REG, 0xFFFFFF);
-	dsi_write(dsi, DSI_LP_RX_TIMEOUT_REG, 0xFFFFFF);
-	dsi_write(dsi, DSI_TURN_AROUND_TIMEOUT_REG, 0x1F);
-	dsi_write(dsi, DSI_DEVICE_RESET_REG, 0xFF);
-	dsi_write(dsi, DSI_INIT_COUNT_REG, 0x7D0);
+	u32 val;
+	int ret;
+	
+	ret = readl_poll_timeout(dsi->reg_base + DSI_GEN_FIFO_STAT_REG, val,
+				 (val & mask) == want, 10, DSI_CMD_TIMEOUT_US);
+	if (ret)
+		dev_err(dsi->dev, "Command FIFO timeout, status 0x%08x\n", val);
+	return ret;
 }
 
-static void elv_mipi_dsi_ddr_clk_calc(struct elv_mipi_dsi *dsi)
-{	
-	struct mipi_dsi_config *dsi_config = &dsi->dsi_config;	
-	int ddr_clk_freq, ddr_clk_freq_rez;	
-	int pixel_format = 0, video_mode_format = 0, lane_count = 1;
-	//float pclk_freq, t_pclk;
-	u32 pclk_freq, t_pclk;
+/*
+ * Передача одного пакета через FIFO команд: полезная нагрузка длинного
+ * пакета пишется словами по 4 байта (младший байт первым), затем в
+ * регистр управления записывается заголовок. Возврат - после того, как
+ * контроллер забрал пакет из FIFO.
+ */
+static int elv_mipi_dsi_write_packet(struct elv_mipi_dsi *dsi,
+				     const struct mipi_dsi_packet *packet, bool hs)
+{
+	u32 data_reg = hs ? DSI_HS_GEN_DATA_REG : DSI_LP_GEN_DATA_REG;
+	u32 ctrl_reg = hs ? DSI_HS_GEN_CTRL_REG : DSI_LP_GEN_CTRL_REG;
+	u32 data_full = hs ? DSI_FIFO_HS_DATA_FULL : DSI_FIFO_LP_DATA_FULL;
+	u32 ctrl_full = hs ? DSI_FIFO_HS_CTRL_FULL : DSI_FIFO_LP_CTRL_FULL;
+	u32 empty = hs ? (DSI_FIFO_HS_DATA_EMPTY | DSI_FIFO_HS_CTRL_EMPTY) :
+			 (DSI_FIFO_LP_DATA_EMPTY | DSI_FIFO_LP_CTRL_EMPTY);
+	const u8 *payload = packet->payload;
+	size_t len = packet->payload_length;
+	u32 word;
+	int i, ret;
 	
-	//pclk_freq = (float)AXI_CLK_MHZ/(PCLK_DIV + 1);
-	pclk_freq = AXI_CLK_MHZ/(PCLK_DIV + 1);
-	//pclk_freq = 24; // hlen * vlen * 60 fps
-	dsi_config->pclk_freq = pclk_freq;
-  
-	//t_pclk = (float)1000/pclk_freq;
-	t_pclk = 1000/pclk_freq;
-	dsi_config->t_pclk = t_pclk;
+	/* FIFO команд лежит между LP_BYTECLK и DPHY_PARAM */
+	BUILD_BUG_ON(DSI_GEN_FIFO_STAT_REG >= DSI_DPHY_PARAM_REG);
 	
-	switch (dsi_config->video_format) {
-		case DSI_video_format_RGB565:
-			pixel_format = 16;
-			break;
-		case DSI_video_format_RGB666:
-			pixel_format = 18;
-			break;
-		case DSI_video_format_RGB666_lp:
-		case DSI_video_format_RGB888:
-			pixel_format = 24;		
-			break;
-		default:
-			break;
-  }
-  
-  if (dsi_config->video_mode == DSI_vd_mode_burst)
-    video_mode_format = 2;
-  else
-    video_mode_format = 1;
-  lane_count = dsi_config->data_lanes;
-
-  ddr_clk_freq = (pclk_freq * pixel_format * video_mode_format) / (2*lane_count);  
-  
-  if ((ddr_clk_freq % 12) != 0) {
-//     if ((ddr_clk_freq % 12) > 5)
-      ddr_clk_freq_rez = (ddr_clk_freq/12+1)*12;
-//     else
-//       ddr_clk_freq_rez = (ddr_clk_freq/12)*12;
-  } else 
-      ddr_clk_freq_rez = ddr_clk_freq;
-  
-  if (ddr_clk_freq_rez > DDR_CLK_FREQ_MAX) {
-    ddr_clk_freq_rez = DDR_CLK_FREQ_MAX;
-    dev_err(dsi->dev, "Error ddr_clk_freq value!\n");
-  }
-  
-  //dsi_config->t_byteclk = (float)4000/ddr_clk_freq;
-  dsi_config->t_byteclk = 4000/ddr_clk_freq;
-  dsi_config->ddr_freq = ddr_clk_freq_rez;
-  /*dev_info(dsi->dev, "ddr_clk_freq = %i\n", dsi_config->ddr_freq);
-  dev_info(dsi->dev, "pclk_freq = %i\n", dsi_config->pclk_freq);
-  dev_info(dsi->dev, "t_pclk = %i\n", dsi_config->t_pclk);
-  dev_info(dsi->dev, "t_byteclk = %i\n", dsi_config->t_byteclk);*/
+	while (len) {
+		size_t n = min_t(size_t, len, 4);
+		
+		ret = elv_mipi_dsi_wait_fifo(dsi, data_full, 0);
+		if (ret)
+			return ret;
+		
+		for (word = 0, i = 0; i < n; i++)
+			word |= payload[i] << (8 * i);
+		dsi_write(dsi, data_reg, word);
+		
+		payload += n;
+		len -= n;
+	}
+	
+	ret = elv_mipi_dsi_wait_fifo(dsi, ctrl_full, 0);
+	if (ret)
+		return ret;
+	
+	dsi_write(dsi, ctrl_reg, packet->header[0] | (packet->header[1] << 8) |
+		  (packet->header[2] << 16));
+	
+	return elv_mipi_dsi_wait_fifo(dsi, empty, empty);
 }
 
-static void elv_mipi_dsi_set_dpi_resolution(struct elv_mipi_dsi *dsi)
+/*
+ * Чтение через BTA: запрос уходит в LP, контроллер передаёт направление
+ * панели и ждёт ответ не дольше DSI_TURN_AROUND_TIMEOUT_REG. Данные ответа
+ * забираются из LP FIFO данных словами по 4 байта. На время чтения
+ * разрешается BTA в видеорежиме, видеопоток не останавливается.
+ */
+static int elv_mipi_dsi_read_packet(struct elv_mipi_dsi *dsi,
+				    const struct mipi_dsi_packet *packet,
+				    const struct mipi_dsi_msg *msg)
 {
-	/* Все значения записываются уменьшенные на единицу, измеряются в количестве тактов частоты PIXCLK
-	* hsw - это HSYNC pulse width  
-	* hgdel_hbp - это Horizontal back porch, (HBP)
-	* hgate_haa - это количество активных пикселей в строке - Horizontal active area (HDISP)
-	* hlen - это var->xres + var->left_margin + var->right_margin + var->hsync_len - 1
-	* vsw - это VSYNC pulse width
-	* vgdel_vbp - это Vertical back porch (VBP)
-	* vgate_vaa - это количество активных строк в кадре - Vertical active area (VDISP)
-	* vlen - это var->yres + var->upper_margin + var->lower_margin + var->vsync_len - 1
-	*/
+	struct elv_mipi_dsi_priv *priv = to_dsi_priv(dsi);
+	u8 *rx = msg->rx_buf;
+	size_t i;
+	u32 word = 0;
+	int ret;
 	
-	struct mipi_dsi_config *dsi_config = &dsi->dsi_config;
-	short int hsw = 11, hgdel_hbp = 11, hgate_haa = 479, hlen = 515; //(480+12+12+12-1)  
-	/*short int hsw = 14, hgdel_hbp = 14, hgate_haa = 479, hlen = 539; //(480+15+15+30-1)*/
-	/*short int vsw = 3, vgdel_vbp = 3, vgate_vaa = 799, vlen = 811; //(800+4+4+4-1)*/
-	short int vsw = 5, vgdel_vbp = 5, vgate_vaa = 799, vlen = 817; 	//(800+6+6+6-1) Значение (6 = 5-1) должно совпадать со значением 
-																	// из команды SETDISP (amount of scan line) см. panel-hx8369a-spi.c
+	dsi_write(dsi, DSI_MAX_RETURN_PACKET_REG, msg->rx_len);
 	
-	dsi_config->DPI_resolution_h = hgate_haa + 1;
-	dsi_config->DPI_resolution_v = vgate_vaa + 1;
-	dsi_config->HSYNC_count = hsw + 1;
-	dsi_config->HSYNC_bpc = hgdel_hbp + 1;
-	dsi_config->HSYNC_fpc = (hlen + 1) - (hgate_haa + 1) - (hgdel_hbp + 1) - (hsw + 1);
-	dsi_config->HSYNC_aac = hgate_haa + 1;
-	dsi_config->VSYNC_count = vsw + 1;
-	dsi_config->VSYNC_bpc = vgdel_vbp + 1;
-	dsi_config->VSYNC_fpc = (vlen + 1) - (vgate_vaa + 1) - (vgdel_vbp + 1) - (vsw + 1);
+	priv->read_status = 0;
+	reinit_completion(&priv->read_done);
+	dsi_write(dsi, DSI_CLK_EOT_REG, elv_mipi_dsi_clk_eot(dsi, true));
 	
-	dsi_write(dsi, DSI_DPI_RESOLUTION_REG, 
-		(dsi_config->DPI_resolution_h | 
-		(dsi_config->DPI_resolution_v << 16)));
-	
-	/* Далее в регистры мы пишем константы вместо рассчитанных значений, т.к. расчет является 
-	   неточным из-за отсутствия нормальной поддержки float в ядре */
-	
-	// По расчету у нас получилось 16 вместо 15
-	dsi_write(dsi, DSI_HSYNC_COUNT_REG, 15);
-	//dsi_write(dsi, DSI_HSYNC_COUNT_REG, DIV_ROUND_UP(dsi_config->HSYNC_count*dsi_config->t_pclk, dsi_config->t_byteclk));
-	//dsi_write(dsi, DSI_HSYNC_COUNT_REG, (u32)dsi_config->HSYNC_count*dsi_config->t_pclk/dsi_config->t_byteclk +1);
-	// DSICONTROLLER->HSYNC_COUNT_REG = ceil((float)l_DSI_dpi_resolution->HSYNC_count*t_pclk/t_byteclk);
-	
-	// У нас получилось 16 вместо 15
-	dsi_write(dsi, DSI_HORIZ_BACK_PORCH_COUNT_REG, 15);
-	//dsi_write(dsi, DSI_HORIZ_BACK_PORCH_COUNT_REG, dsi_max(DIV_ROUND_UP(dsi_config->HSYNC_bpc*dsi_config->t_pclk, dsi_config->t_byteclk), HSYNC_bpc_min)); 
-	//dsi_write(dsi, DSI_HORIZ_BACK_PORCH_COUNT_REG, dsi_max((u32)dsi_config->HSYNC_bpc*dsi_config->t_pclk/dsi_config->t_byteclk +1, HSYNC_bpc_min)); 
-	// DSICONTROLLER->HORIZ_BACK_PORCH_COUNT_REG = dsi_max(ceil((float)l_DSI_dpi_resolution->HSYNC_bpc*t_pclk/t_byteclk), HSYNC_bpc_min);
-	
-	// У нас получилось 16 вместо 15
-	dsi_write(dsi, DSI_HORIZ_FRONT_PORCH_COUNT_REG, 15);
-	//dsi_write(dsi, DSI_HORIZ_FRONT_PORCH_COUNT_REG, dsi_max(DIV_ROUND_UP(dsi_config->HSYNC_fpc*dsi_config->t_pclk, dsi_config->t_byteclk), HSYNC_fpc_min));
-	//dsi_write(dsi, DSI_HORIZ_FRONT_PORCH_COUNT_REG, dsi_max((u32)dsi_config->HSYNC_fpc*dsi_config->t_pclk/dsi_config->t_byteclk +1, HSYNC_fpc_min)); 
-	// DSICONTROLLER->HORIZ_FRONT_PORCH_COUNT_REG = dsi_max(ceil((float)l_DSI_dpi_resolution->HSYNC_fpc*t_pclk/t_byteclk), HSYNC_fpc_min);
-  
-	// У нас получилось 729 вместо 720
-	dsi_write(dsi, DSI_HORIZ_ACTIVE_AREA_COUNT_REG, 720);
-	//dsi_write(dsi, DSI_HORIZ_ACTIVE_AREA_COUNT_REG, DIV_ROUND_UP(dsi_config->HSYNC_aac*dsi_config->t_pclk, dsi_config->t_byteclk));
-	//dsi_write(dsi, DSI_HORIZ_ACTIVE_AREA_COUNT_REG, (u32)dsi_config->HSYNC_aac*dsi_config->t_pclk/dsi_config->t_byteclk +1);
-	// DSICONTROLLER->HORIZ_ACTIVE_AREA_COUNT_REG = ceil((float)l_DSI_dpi_resolution->HSYNC_aac*t_pclk/t_byteclk);
+	ret = elv_mipi_dsi_write_packet(dsi, packet, false);
+	if (ret)
+		goto out;
 	
-	dsi_write(dsi, DSI_VSYNC_COUNT_REG, dsi_config->VSYNC_count);  
-	// DSICONTROLLER->VSYNC_COUNT_REG = l_DSI_dpi_resolution->VSYNC_count;
+	if (!wait_for_completion_timeout(&priv->read_done,
+					 msecs_to_jiffies(DSI_READ_TIMEOUT_MS)) ||
+	    !(priv->read_status & DSI_INT_GEN_READ_DATA)) {
+		dev_dbg(dsi->dev, "DCS read 0x%02x: no response (status 0x%08x)\n",
+			packet->header[1], priv->read_status);
+		ret = -ETIMEDOUT;
+		goto out;
+	}
 	
-	dsi_write(dsi, DSI_VERT_BACK_PORCH_COUNT_REG, dsi_max(dsi_config->VSYNC_bpc, VSYNC_bpc_min));
-	// DSICONTROLLER->VERT_BACK_PORCH_COUNT_REG = dsi_max(l_DSI_dpi_resolution->VSYNC_bpc, VSYNC_bpc_min);
+	for (i = 0; i < msg->rx_len; i++) {
+		if (!(i % 4))
+			word = dsi_read(dsi, DSI_LP_GEN_DATA_REG);
+		rx[i] = word >> (8 * (i % 4));
+	}
+	ret = msg->rx_len;
 	
-	dsi_write(dsi, DSI_VERT_FRONT_PORCH_COUNT_REG, dsi_max(dsi_config->VSYNC_fpc, VSYNC_fpc_min));
-	// DSICONTROLLER->VERT_FRONT_PORCH_COUNT_REG = dsi_max(l_DSI_dpi_resolution->VSYNC_fpc, VSYNC_fpc_min);
+out:
+	dsi_write(dsi, DSI_CLK_EOT_REG, elv_mipi_dsi_clk_eot(dsi, false));
+	return ret;
 }
 
-static void elv_mipi_dsi_set_dphy_timings(struct elv_mipi_dsi *dsi)
+static ssize_t elv_mipi_dsi_host_transfer(struct mipi_dsi_host *host,
+					  const struct mipi_dsi_msg *msg)
 {
-	struct mipi_dsi_config *dsi_config = &dsi->dsi_config;
-	//   Note: UI is any DDR half cycle.
-	//   UI = 500/ddr_clk_freq;
-	int HS_PREP_tbl, HS_ZERO_tbl, HS_TRAIL_tbl, HS_EXIT_tbl = 115;
-	int n = 1;	// Where n = 1 for Forward-direction HS mode and n = 4 for Reverse-direction HS mode
-	int dln_cnt_hs_prep, dln_cnt_hs_zero, dln_cnt_hs_trail, dln_cnt_hs_exit,
-    cln_cnt_prep, cln_cnt_zero, cln_cnt_hs_trail, cln_cnt_hs_exit,
-    lp_byteclk, high_ls_count, hs_to_lp_switch_count, lp_to_hs_switch_count;
-    int CLK_PREP_tbl = 60, CLK_ZERO_tbl, CLK_TRAIL_tbl = 60, CLK_EXIT_tbl = 60;
-    
-    /* Константы 115, 60, 170, 30 и т.п. взяты из примера "MIPI DSI test" от Элвиса, в элвисовский пример
-     * они попали из документа "MIPI Alliance Specification for D-PHY Version 1.00.00 - 14 May 2009", из
-     * переписки с Элвисом: "Конкретнее - эти тайминги взяты из таблицы 14 на стр. 53 (п. 5.9) указанного документа.
-     * В нашем примере выбраны средние допустимые значения из этой таблицы, либо, если указана только нижняя граница, 
-     * то значения с небольшим отступом от этой границы".
-     */ 
-  
-	HS_PREP_tbl = 60 + DIV_ROUND_UP(4*500, dsi_config->ddr_freq);
-	//HS_PREP_tbl = (int)(60 + 4*500/dsi_config->ddr_freq);
-	// HS_PREP_tbl = ceil(60 + (float)4*500/ddr_clk_freq);
-	
-	HS_ZERO_tbl = 170 + DIV_ROUND_UP(10*500, dsi_config->ddr_freq) - HS_PREP_tbl;	
-	//HS_ZERO_tbl = (int)(170 + 10*500/dsi_config->ddr_freq) - HS_PREP_tbl;	
-	// HS_ZERO_tbl = ceil(170 + (float)10*500/ddr_clk_freq) - HS_PREP_tbl;
-	
-	HS_TRAIL_tbl = dsi_max( DIV_ROUND_UP(n*8*500, dsi_config->ddr_freq), (60 + DIV_ROUND_UP(n*4*500, dsi_config->ddr_freq)) ) + 30;
-	//HS_TRAIL_tbl = dsi_max((int)(n*8*500/dsi_config->ddr_freq), (int)(60 + n*4*500/dsi_config->ddr_freq)) + 30;	
-	// HS_TRAIL_tbl = dsi_max(ceil((float)n*8*500/ddr_clk_freq), ceil(60 + (float)n*4*500/ddr_clk_freq)) + 30;
-  	
-	// В обоих случаях получились отрицательные числа, которые приводятся к 0 ниже
-	dln_cnt_hs_prep = DIV_ROUND_CLOSEST( abs( (HS_PREP_tbl - DIV_ROUND_CLOSEST(9*1000, dsi_config->ddr_freq ))), dsi_config->t_byteclk ) - 1;
-	//dln_cnt_hs_prep = (int)(abs(HS_PREP_tbl - 9*1000/dsi_config->ddr_freq)/dsi_config->t_byteclk - 1);	
-	// dln_cnt_hs_prep =	round((float)abs(HS_PREP_tbl - 9*1000/ddr_clk_freq)/t_byteclk - 1);
-	
-	dln_cnt_hs_zero = DIV_ROUND_UP(HS_ZERO_tbl, dsi_config->t_byteclk) - 1;
-	//dln_cnt_hs_zero = (int)(HS_ZERO_tbl/dsi_config->t_byteclk - 1);
-	// dln_cnt_hs_zero =	ceil((float)HS_ZERO_tbl/t_byteclk - 1);
-	
-	dln_cnt_hs_trail =	DIV_ROUND_UP(HS_TRAIL_tbl, dsi_config->t_byteclk) - 2;
-	//dln_cnt_hs_trail =	(int)(HS_TRAIL_tbl/dsi_config->t_byteclk - 2);	
-	// dln_cnt_hs_trail =	ceil((float)HS_TRAIL_tbl/t_byteclk - 2);
-	
-	dln_cnt_hs_exit =	DIV_ROUND_UP(HS_EXIT_tbl, dsi_config->t_byteclk) - 1;
-	//dln_cnt_hs_exit =	(int)(HS_EXIT_tbl/dsi_config->t_byteclk - 1);
-	//dln_cnt_hs_exit =	ceil((float)HS_EXIT_tbl/t_byteclk - 1);
-	
-	if (dln_cnt_hs_prep < 0)
-		dln_cnt_hs_prep = 0;
-	if (dln_cnt_hs_zero < 0)
-		dln_cnt_hs_zero = 0;
-	if (dln_cnt_hs_trail < 0)
-		dln_cnt_hs_trail = 0;
-	if (dln_cnt_hs_exit < 0)
-		dln_cnt_hs_exit = 0;
-  
+	struct elv_mipi_dsi_priv *priv = host_to_dsi_priv(host);
+	struct elv_mipi_dsi *dsi = &priv->dsi;
+	struct mipi_dsi_packet packet;
+	int ret;
 	
-	CLK_ZERO_tbl = 330 - CLK_PREP_tbl;
-  
-	cln_cnt_prep =	DIV_ROUND_UP(CLK_PREP_tbl, dsi_config->t_byteclk) - 1;
-	//cln_cnt_prep =	(int)(CLK_PREP_tbl/dsi_config->t_byteclk - 1);
-	//cln_cnt_prep =	ceil((float)CLK_PREP_tbl/t_byteclk - 1);
-	
-	cln_cnt_zero =	DIV_ROUND_UP(CLK_ZERO_tbl, dsi_config->t_byteclk) - 1;
-	//cln_cnt_zero =	(int)(CLK_ZERO_tbl/dsi_config->t_byteclk - 1);
-	//cln_cnt_zero =	ceil((float)CLK_ZERO_tbl/t_byteclk - 1);
-
-	cln_cnt_hs_trail =	DIV_ROUND_UP((CLK_TRAIL_tbl - DIV_ROUND_CLOSEST(3*1000, dsi_config->ddr_freq)), dsi_config->t_byteclk) + 3;
-	//cln_cnt_hs_trail =	(int)((CLK_TRAIL_tbl - 3*1000/dsi_config->ddr_freq)/dsi_config->t_byteclk) + 3;
-	//cln_cnt_hs_trail =	ceil((float)(CLK_TRAIL_tbl - 3*1000/ddr_clk_freq)/t_byteclk) + 3;
-	
-	cln_cnt_hs_exit =	DIV_ROUND_UP((CLK_EXIT_tbl - DIV_ROUND_CLOSEST(2*1000, dsi_config->ddr_freq)), dsi_config->t_byteclk) - 1;
-	//cln_cnt_hs_exit =	(int)((CLK_EXIT_tbl - 2*1000/dsi_config->ddr_freq)/dsi_config->t_byteclk - 1);	
-	//cln_cnt_hs_exit =	ceil((float)(CLK_EXIT_tbl - 2*1000/ddr_clk_freq)/t_byteclk - 1);
-	
-	if (cln_cnt_prep < 0)
-		cln_cnt_prep = 0;
-	if (cln_cnt_zero < 0)
-		cln_cnt_zero = 0;
-	if (cln_cnt_hs_trail < 0)
-		cln_cnt_hs_trail = 0;
-	if (cln_cnt_hs_exit < 0)
-		cln_cnt_hs_exit = 0;
-  
-  lp_byteclk = DIV_ROUND_UP(dsi_config->ddr_freq, (12*4));
-  //lp_byteclk = (int)(dsi_config->ddr_freq/(12*4));
-  //lp_byteclk = ceil((float)ddr_clk_freq/(12*4));
-  
-  /* Далее в регистры мы пишем константы вместо рассчитанных значений, т.к. расчет является 
-	 неточным из-за отсутствия нормальной поддержки float в ядре */
-  
-  high_ls_count = 101;/*4*lp_byteclk + dln_cnt_hs_prep + dln_cnt_hs_zero + 4*dsi_config->t_byteclk;*/
-  //high_ls_count = 4*lp_byteclk + dln_cnt_hs_prep + dln_cnt_hs_zero + 4*(int)t_byteclk;
-  
-  hs_to_lp_switch_count = 89;/*cln_cnt_hs_trail + cln_cnt_hs_exit + 3*dsi_config->t_byteclk;*/
-  //hs_to_lp_switch_count = cln_cnt_hs_trail + cln_cnt_hs_exit + 3*(int)t_byteclk;
-  
-  lp_to_hs_switch_count = 162;/*4*lp_byteclk + cln_cnt_prep + cln_cnt_zero + DIV_ROUND_UP(8*500, dsi_config->ddr_freq) + 4*dsi_config->t_byteclk;*/
-  //lp_to_hs_switch_count = 4*lp_byteclk + cln_cnt_prep + cln_cnt_zero + (int)((float)8*500/dsi_config->ddr_freq) + 4*(int)dsi_config->t_byteclk;
-  //lp_to_hs_switch_count = 4*lp_byteclk + cln_cnt_prep + cln_cnt_zero + (int)ceil((float)8*500/ddr_clk_freq) + 4*(int)t_byteclk;
-    
-  dsi_write(dsi, DSI_DPHY_PARAM_REG, (dln_cnt_hs_prep | (dln_cnt_hs_zero << 8) | (dln_cnt_hs_trail << 16) | (dln_cnt_hs_exit << 24)));
-  /*buf_reg = DSICONTROLLER->DPHY_PARAM_REG;
-  buf_reg = SET_DSI_CONTROLLER_MODEL_DPHY_PARAM_REG_HS_PREP(buf_reg, dln_cnt_hs_prep);
-  buf_reg = SET_DSI_CONTROLLER_MODEL_DPHY_PARAM_REG_HS_ZERO(buf_reg, dln_cnt_hs_zero);
-  buf_reg = SET_DSI_CONTROLLER_MODEL_DPHY_PARAM_REG_HS_TRAIL(buf_reg, dln_cnt_hs_trail);
-  buf_reg = SET_DSI_CONTROLLER_MODEL_DPHY_PARAM_REG_HS_EXIT(buf_reg, dln_cnt_hs_exit);
-  DSICONTROLLER->DPHY_PARAM_REG = buf_reg;*/
-  
-  dsi_write(dsi, DSI_CLK_LANE_TIMING_PARAM_REG, (cln_cnt_prep | (cln_cnt_zero << 8) | (cln_cnt_hs_trail << 16) | (cln_cnt_hs_exit << 24)));
-  /*buf_reg = DSICONTROLLER->CLK_LANE_TIMING_PARAM_REG;
-  buf_reg = SET_DSI_CONTROLLER_MODEL_CLK_LANE_TIMING_PARAM_REG_HS_PREP(buf_reg, cln_cnt_prep);
-  buf_reg = SET_DSI_CONTROLLER_MODEL_CLK_LANE_TIMING_PARAM_REG_HS_ZERO(buf_reg, cln_cnt_zero);
-  buf_reg = SET_DSI_CONTROLLER_MODEL_CLK_LANE_TIMING_PARAM_REG_HS_TRAIL(buf_reg, cln_cnt_hs_trail);
-  buf_reg = SET_DSI_CONTROLLER_MODEL_CLK_LANE_TIMING_PARAM_REG_HS_EXIT(buf_reg, cln_cnt_hs_exit);
-  DSICONTROLLER->CLK_LANE_TIMING_PARAM_REG = buf_reg;*/
-  
-  dsi_write(dsi, DSI_LP_BYTECLK_REG, lp_byteclk);
-  dsi_write(dsi, DSI_HIGH_LOW_SWITCH_COUNT_REG, high_ls_count);
-  /*DSICONTROLLER->LP_BYTECLK_REG = SET_DSI_CONTROLLER_MODEL_LP_BYTECLK_REG_BYTECLK(DSICONTROLLER->LP_BYTECLK_REG, lp_byteclk);
-  DSICONTROLLER->HIGH_LOW_SWITCH_COUNT_REG = SET_DSI_CONTROLLER_MODEL_HIGH_LOW_SWITCH_COUNT_REG_DATA_LANE_SWITCH_COUNT(DSICONTROLLER->HIGH_LOW_SWITCH_COUNT_REG, high_ls_count);*/
-  
-  dsi_write(dsi, DSI_CLK_LANE_SWT_REG, (hs_to_lp_switch_count | (lp_to_hs_switch_count << 16)));
-  /*buf_reg = DSICONTROLLER->CLK_LANE_SWT_REG;
-  buf_reg = SET_DSI_CONTROLLER_MODEL_CLK_LANE_SWT_REG_HS_TO_LP_SWITCHING_COUNTER(buf_reg, hs_to_lp_switch_count);
-  buf_reg = SET_DSI_CONTROLLER_MODEL_CLK_LANE_SWT_REG_LP_TO_HS_SWITCHING_COUNTER(buf_reg, lp_to_hs_switch_count);
-  DSICONTROLLER->CLK_LANE_SWT_REG = buf_reg;*/
+	ret = mipi_dsi_create_packet(&packet, msg);
+	if (ret)
+		return ret;
+	
+	pm_runtime_get_sync(dsi->dev);
+	mutex_lock(&priv->lock);
+	
+	/* В ULPS и при выключенном контроллере линии не передают пакеты */
+	if (dsi->ulp_mode)
+		ret = -EIO;
+	else if (msg->rx_len)
+		ret = elv_mipi_dsi_read_packet(dsi, &packet, msg);
+	else
+		ret = elv_mipi_dsi_write_packet(dsi, &packet,
+				!(msg->flags & MIPI_DSI_MSG_USE_LPM));
+	
+	mutex_unlock(&priv->lock);
+	pm_runtime_mark_last_busy(dsi->dev);
+	pm_runtime_put_autosuspend(dsi->dev);
+	
+	if (ret < 0)
+		return ret;
+	return msg->rx_len ? ret : msg->tx_len;
 }
 
-static void elv_mipi_dsi_set_pll_div_ratio(struct elv_mipi_dsi *dsi)
+/*
+ * К линку может быть подключено до четырёх устройств (панель, мост и т.п.),
+ * номер виртуального канала - reg дочернего узла DT. Команды на любой
+ * канал идут через FIFO команд параллельно с видеопотоком на video_vc.
+ */
+static int elv_mipi_dsi_host_attach(struct mipi_dsi_host *host,
+				    struct mipi_dsi_device *device)
 {
-	struct mipi_dsi_config *dsi_config = &dsi->dsi_config;
-	unsigned int div_ratio, l_div_ratio, other_bits;
+	struct elv_mipi_dsi_priv *priv = host_to_dsi_priv(host);
 	
-	div_ratio = dsi_config->ddr_freq/12;
-	//dev_info(dsi->dev, "div_ratio = %i\n", div_ratio);
+	if (device->channel >= ARRAY_SIZE(priv->devices))
+		return -EINVAL;
+	if (priv->devices[device->channel])
+		return -EBUSY;
 	
-	if (div_ratio < div_ratio_min)
-		l_div_ratio = div_ratio_min;
-	else if (div_ratio > div_ratio_max)
-		l_div_ratio = div_ratio_max;
-	else
-		l_div_ratio = div_ratio;	
-		
-	other_bits = 0u | BIT(11) | BIT(12) | BIT(13) | BIT(16) | BIT(18) | BIT(20) | BIT(21);
-	dsi_write(dsi, DSI_TRIM1_REG, (l_div_ratio >> 1) | ((l_div_ratio & 0x01) << 6) | other_bits) ;
-  	/*buf_reg = DSICONTROLLER->TRIM_REG1;
-	buf_reg = SET_DSI_CONTROLLER_MODEL_TRIM_REG1_CNT_A(buf_reg, l_div_ratio >> 1);
-	buf_reg = SET_DSI_CONTROLLER_MODEL_TRIM_REG1_CNT_B(buf_reg, l_div_ratio & 0x01);
-	DSICONTROLLER->TRIM_REG1 = buf_reg;*/
+	if (device->channel == priv->video_vc && device->lanes &&
+	    device->lanes != priv->lanes)
+		dev_warn(host->dev, "%s: panel wants %u lanes, link has %u\n",
+			 device->name, device->lanes, priv->lanes);
+	
+	priv->devices[device->channel] = device;
+	return 0;
 }
 
-static void elv_mipi_dsi_start_dsi(struct elv_mipi_dsi *dsi)
+static int elv_mipi_dsi_host_detach(struct mipi_dsi_host *host,
+				    struct mipi_dsi_device *device)
 {
-	dsi_write(dsi, DSI_RST_ENABLE_DFE_REG, DFE_RST_ENABLE);
-	dsi_write(dsi, DSI_DEVICE_READY_REG, DEVICE_ENABLE);
-	dsi_write(dsi, DSI_DPI_CONTROL_REG, TURN_ON_PERIPHERAL);  // Добавлено для корректной работы DSI контроллера в Linux после его использования в u-boot
+	struct elv_mipi_dsi_priv *priv = host_to_dsi_priv(host);
+	
+	if (device->channel < ARRAY_SIZE(priv->devices) &&
+	    priv->devices[device->channel] == device)
+		priv->devices[device->channel] = NULL;
+	return 0;
 }
 
-static int elv_mipi_dsi_is_enable(struct elv_mipi_dsi *dsi)
+static const struct mipi_dsi_host_ops elv_mipi_dsi_host_ops = {
+	.attach = elv_mipi_dsi_host_attach,
+	.detach = elv_mipi_dsi_host_detach,
+	.transfer = elv_mipi_dsi_host_transfer,
+};
+
+/* Отправка DCS команды панели видеоканала из FIFO команд в HS, под priv->lock */
+static int elv_mipi_dsi_dcs_send(struct elv_mipi_dsi *dsi, const u8 *data, size_t len)
 {
-	u32 ret;
+	struct mipi_dsi_packet packet;
+	struct mipi_dsi_msg msg = {
+		.channel = to_dsi_priv(dsi)->video_vc,
+		.tx_buf = data,
+		.tx_len = len,
+	};
+	int ret;
 	
-	ret = dsi_read(dsi, DSI_DEVICE_READY_REG);
-	return (ret & DEVICE_ENABLE);
+	switch (len) {
+	case 1:
+		msg.type = MIPI_DSI_DCS_SHORT_WRITE;
+		break;
+	case 2:
+		msg.type = MIPI_DSI_DCS_SHORT_WRITE_PARAM;
+		break;
+	default:
+		msg.type = MIPI_DSI_DCS_LONG_WRITE;
+		break;
+	}
+	
+	ret = mipi_dsi_create_packet(&packet, &msg);
+	if (ret)
+		return ret;
+	
+	return elv_mipi_dsi_write_packet(dsi, &packet, true);
 }
 
-static void elv_mipi_dsi_init_dsi(struct elv_mipi_dsi *dsi)
-{	
-	// Добавлено для корректной работы DSI контроллера в Linux после его использования в u-boot	
-	if (elv_mipi_dsi_is_enable(dsi))
-		elv_mipi_dsi_ulp_mode(dsi); 
+static int elv_mipi_dsi_dcs_set_window(struct elv_mipi_dsi *dsi, u8 cmd,
+				       u16 start, u16 end)
+{
+	u8 buf[5] = { cmd, start >> 8, start & 0xff, end >> 8, end & 0xff };
 	
-	elv_mipi_dsi_config_dsi(dsi);
-	elv_mipi_dsi_set_base_timings(dsi);
-	elv_mipi_dsi_ddr_clk_calc(dsi);
-	elv_mipi_dsi_set_dpi_resolution(dsi);
-	elv_mipi_dsi_set_dphy_timings(dsi);
-	elv_mipi_dsi_set_pll_div_ratio(dsi);
-	elv_mipi_dsi_start_dsi(dsi);
-	elv_mipi_dsi_turn_on(dsi);
+	return elv_mipi_dsi_dcs_send(dsi, buf, sizeof(buf));
 }
 
-static irqreturn_t dsi_irq_handler(int irq, void *dev_id)
+/*
+ * Формат пикселей write_memory панель берёт из set_pixel_format; команда
+ * повторяется, если формат линка сменился через sysfs mode. Под priv->lock.
+ */
+static int elv_mipi_dsi_dcs_pixel_format(struct elv_mipi_dsi *dsi)
 {
-	struct elv_mipi_dsi *dsi = (struct elv_mipi_dsi *)dev_id;
-	u32 irqstatus;
-
-	irqstatus = dsi_read(dsi, DSI_IRQ_STATUS_REG);
-
-	/*if (irqstatus & INT_OUTFIFO)
-		tasklet_schedule(&par->reset_tasklet);*/
+	struct elv_mipi_dsi_priv *priv = to_dsi_priv(dsi);
+	u8 fmt = priv->format->dcs_fmt;
+	u8 buf[2] = { MIPI_DCS_SET_PIXEL_FORMAT, (fmt << 4) | fmt };
+	int ret;
 	
-	dsi_write(dsi, DSI_IRQ_STATUS_REG, irqstatus);
+	if (priv->cmd_dcs_fmt == fmt)
+		return 0;
+	
+	ret = elv_mipi_dsi_dcs_send(dsi, buf, sizeof(buf));
+	if (!ret)
+		priv->cmd_dcs_fmt = fmt;
+	return ret;
+}
 
+static irqreturn_t elv_mipi_dsi_te_irq(int irq, void *dev_id)
+{
+	struct elv_mipi_dsi_priv *priv = dev_id;
+	
+	complete(&priv->te_done);
+	elv_mipi_dsi_vblank(&priv->dsi);
 	return IRQ_HANDLED;
 }
 
-static struct attribute *elv_mipi_dsi_attrs[] = {
-    &dev_attr_ulp_mode.attr,
-    NULL
-};
+/*
+ * Обновление прямоугольной области панели в командном режиме: окно
+ * задаётся set_column_address/set_page_address, пиксели передаются
+ * write_memory_start/write_memory_continue. Передача начинается по
+ * сигналу TE панели, чтобы не было разрывов изображения. Данные fb
+ * должны быть в формате pixel-format линка, pitch - длина строки в байтах.
+ * Контроллер в командном режиме DPI не читает, вывод видеовыхода на DSI
+ * можно остановить.
+ */
+int elv_mipi_dsi_update_region(struct elv_mipi_dsi *dsi, const void *fb,
+			       u32 pitch, u32 x, u32 y, u32 w, u32 h)
+{
+	struct elv_mipi_dsi_priv *priv = to_dsi_priv(dsi);
+	u32 bytespp = DIV_ROUND_UP(priv->timings.bpp, 8);
+	u32 chunk = rounddown(DSI_CMD_MAX_PAYLOAD, bytespp);
+	u8 cmd = MIPI_DCS_WRITE_MEMORY_START;
+	u32 row, off, n, fill = 0;
+	int ret;
+	
+	if (!priv->cmd_mode)
+		return -EOPNOTSUPP;
+	if (!w || !h || x + w > priv->vm.hactive || y + h > priv->vm.vactive)
+		return -EINVAL;
+	
+	elv_mipi_dsi_frame_activity(dsi);
+	pm_runtime_get_sync(dsi->dev);
+	mutex_lock(&priv->lock);
+	
+	if (dsi->ulp_mode) {
+		ret = -EIO;
+		goto out;
+	}
+	
+	ret = elv_mipi_dsi_dcs_pixel_format(dsi);
+	if (ret)
+		goto out;
+	
+	if (priv->te_gpio) {
+		reinit_completion(&priv->te_done);
+		if (!wait_for_completion_timeout(&priv->te_done,
+						 msecs_to_jiffies(DSI_TE_TIMEOUT_MS)))
+			priv->te_timeouts++;
+	}
+	
+	ret = elv_mipi_dsi_dcs_set_window(dsi, MIPI_DCS_SET_COLUMN_ADDRESS, x, x + w - 1);
+	if (!ret)
+		ret = elv_mipi_dsi_dcs_set_window(dsi, MIPI_DCS_SET_PAGE_ADDRESS, y, y + h - 1);
+	
+	/* Строки области склеиваются в пакеты по chunk байт */
+	for (row = 0; !ret && row < h; row++) {
+		const u8 *src = (const u8 *)fb + (y + row) * pitch + x * bytespp;
+		
+		for (off = 0; !ret && off < w * bytespp; off += n) {
+			n = min(w * bytespp - off, chunk - fill);
+			memcpy(priv->cmd_buf + 1 + fill, src + off, n);
+			fill += n;
+			if (fill < chunk && !(row == h - 1 && off + n == w * bytespp))
+				continue;
+			
+			priv->cmd_buf[0] = cmd;
+			ret = elv_mipi_dsi_dcs_send(dsi, priv->cmd_buf, fill + 1);
+			priv->cmd_bytes += fill;
+			cmd = MIPI_DCS_WRITE_MEMORY_CONTINUE;
+			fill = 0;
+		}
+	}
+	
+	if (!ret)
+		priv->cmd_updates++;
+out:
+	mutex_unlock(&priv->lock);
+	pm_runtime_mark_last_busy(dsi->dev);
+	pm_runtime_put_autosuspend(dsi->dev);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(elv_mipi_dsi_update_region);
 
-static struct attribute_group elv_mipi_dsi_attr_group = {
-    .name = "elv_mipi_dsi",
-    .attrs = elv_mipi_dsi_attrs,
-};
+static int elv_mipi_dsi_init_cmd_mode(struct elv_mipi_dsi *dsi)
+{
+	struct elv_mipi_dsi_priv *priv = to_dsi_priv(dsi);
+	u8 tear_on[2] = { MIPI_DCS_SET_TEAR_ON, 0 };	/* TE только по VBLANK */
+	int ret;
+	
+	init_completion(&priv->te_done);
+	
+	if (!priv->cmd_mode)
+		return 0;
+	
+	priv->cmd_buf = devm_kzalloc(dsi->dev, DSI_CMD_MAX_PAYLOAD + 1, GFP_KERNEL);
+	if (!priv->cmd_buf)
+		return -ENOMEM;
+	
+	priv->te_gpio = devm_gpiod_get_optional(dsi->dev, "te", GPIOD_IN);
+	if (IS_ERR(priv->te_gpio))
+		return PTR_ERR(priv->te_gpio);
+	
+	if (priv->te_gpio) {
+		ret = devm_request_irq(dsi->dev, gpiod_to_irq(priv->te_gpio),
+				       elv_mipi_dsi_te_irq, IRQF_TRIGGER_RISING,
+				       "elvees-mipi-dsi-te", priv);
+		if (ret) {
+			dev_err(dsi->dev, "Cannot request TE irq\n");
+			return ret;
+		}
+	}
+	
+	pm_runtime_get_sync(dsi->dev);
+	mutex_lock(&priv->lock);
+	ret = elv_mipi_dsi_dcs_pixel_format(dsi);
+	if (!ret)
+		ret = elv_mipi_dsi_dcs_send(dsi, tear_on, sizeof(tear_on));
+	mutex_unlock(&priv->lock);
+	pm_runtime_put_autosuspend(dsi->dev);
+	
+	dev_info(dsi->dev, "command mode, TE %s\n", priv->te_gpio ? "gpio" : "none");
+	return ret;
+}
 
 #ifdef	CONFIG_PM
 
 static int dsi_dev_suspend(struct device *dev)
 {
 	struct elv_mipi_dsi *dsi = (struct elv_mipi_dsi *)dev->driver_data;
+	
+	/* После runtime suspend линк уже в ULPS, а dphy_clk выключен */
+	if (pm_runtime_status_suspended(dev))
+		return 0;
 		
-	elv_mipi_dsi_ulp_mode(dsi);
+	if (!dsi->ulp_mode)
+		elv_mipi_dsi_ulp_mode(dsi);
 	/*dev_info(dev, "DSI suspend ok!\n");*/
 	return 0;
 }
@@ -656,15 +2980,84 @@ static int dsi_dev_resume(struct device *dev)
 {
 	struct elv_mipi_dsi *dsi = (struct elv_mipi_dsi *)dev->driver_data;
 	
-	elv_mipi_dsi_normal_mode(dsi);
+	if (pm_runtime_status_suspended(dev))
+		return 0;
+	
+	if (elv_mipi_dsi_dphy_clk_on(dsi))
+		return 0;
+	if (!elv_mipi_dsi_restore_context(dsi))
+		elv_mipi_dsi_normal_mode(dsi);
 	/*dev_info(dev, "DSI resume ok!\n");*/
 	return 0;
 }
 
+/*
+ * Runtime PM: после dsi_autosuspend_delay секунд без кадров (по умолчанию
+ * выключено) линии переводятся в ULPS и выключается dphy_clk. Если ULPS был включён
+ * вручную через sysfs ulp_mode, при выходе он сохраняется.
+ */
+static void dsi_rpm_account(struct elv_mipi_dsi_priv *priv, bool was_suspended)
+{
+	ktime_t now = ktime_get();
+	u64 delta = ktime_us_delta(now, priv->rpm_stamp);
+	
+	if (was_suspended)
+		priv->rpm_suspended_us += delta;
+	else
+		priv->rpm_active_us += delta;
+	priv->rpm_stamp = now;
+}
+
+static int dsi_runtime_suspend(struct device *dev)
+{
+	struct elv_mipi_dsi *dsi = dev_get_drvdata(dev);
+	struct elv_mipi_dsi_priv *priv = to_dsi_priv(dsi);
+	
+	mutex_lock(&priv->lock);
+	dsi_rpm_account(priv, false);
+	priv->rpm_ulps = !dsi->ulp_mode;
+	if (priv->rpm_ulps)
+		elv_mipi_dsi_ulp_mode(dsi);
+	elv_mipi_dsi_dphy_clk_off(dsi);
+	priv->rpm_suspends++;
+	mutex_unlock(&priv->lock);
+	
+	return 0;
+}
+
+static int dsi_runtime_resume(struct device *dev)
+{
+	struct elv_mipi_dsi *dsi = dev_get_drvdata(dev);
+	struct elv_mipi_dsi_priv *priv = to_dsi_priv(dsi);
+	int ret;
+	
+	mutex_lock(&priv->lock);
+	ret = elv_mipi_dsi_dphy_clk_on(dsi);
+	if (ret) {
+		mutex_unlock(&priv->lock);
+		return ret;
+	}
+	
+	dsi_rpm_account(priv, true);
+	if (elv_mipi_dsi_restore_context(dsi)) {
+		/* Линк запущен заново, ручной ULPS тоже сброшен */
+	} else if (priv->rpm_ulps) {
+		elv_mipi_dsi_normal_mode(dsi);
+	} else if (dsi->ulp_mode) {
+		/* Ручной ULPS сохраняется, dphy_clk ему не нужен */
+		elv_mipi_dsi_dphy_clk_off(dsi);
+	}
+	priv->rpm_ulps = false;
+	mutex_unlock(&priv->lock);
+	
+	return 0;
+}
+
 static const struct dev_pm_ops dsi_device_pm_ops = {
 	.suspend =	dsi_dev_suspend,
 	.freeze =	dsi_dev_suspend,
 	.resume =	dsi_dev_resume,
+	SET_RUNTIME_PM_OPS(dsi_runtime_suspend, dsi_runtime_resume, NULL)
 };
 
 #endif
@@ -672,9 +3065,52 @@ static const struct dev_pm_ops dsi_device_pm_ops = {
 /*static UNIVERSAL_DEV_PM_OPS(dsi_device_pm_ops, dsi_dev_suspend,
                             dsi_dev_resume, NULL);*/
 
+/*
+ * Плоский кэш заполняется текущими значениями регистров: значения по
+ * умолчанию у контроллера не описаны, а u-boot мог уже настроить линк.
+ */
+static int elv_mipi_dsi_init_regmap(struct elv_mipi_dsi *dsi)
+{
+	struct elv_mipi_dsi_priv *priv = to_dsi_priv(dsi);
+	struct regmap_config config = {
+		.reg_bits = 32,
+		.val_bits = 32,
+		.reg_stride = 4,
+		.fast_io = true,	/* регистры читаются из обработчика прерывания */
+		.readable_reg = dsi_known_reg,
+		.writeable_reg = dsi_known_reg,
+		.volatile_reg = dsi_volatile_reg,
+		.precious_reg = dsi_precious_reg,
+		.reg_read = dsi_regmap_read,
+		.reg_write = dsi_regmap_write,
+		.cache_type = REGCACHE_FLAT,
+	};
+	unsigned int val;
+	int i;
+	
+	for (i = 0; i < ARRAY_SIZE(elv_dsi_ctx_regs); i++)
+		config.max_register = max(config.max_register, elv_dsi_ctx_regs[i]);
+	for (i = 0; i < ARRAY_SIZE(elv_dsi_volatile_regs); i++)
+		config.max_register = max(config.max_register, elv_dsi_volatile_regs[i]);
+	
+	priv->map = devm_regmap_init(dsi->dev, NULL, priv, &config);
+	if (IS_ERR(priv->map))
+		return PTR_ERR(priv->map);
+	
+	regcache_cache_only(priv->map, true);
+	for (i = 0; i < ARRAY_SIZE(elv_dsi_ctx_regs); i++) {
+		dsi_regmap_read(priv, elv_dsi_ctx_regs[i], &val);
+		regmap_write(priv->map, elv_dsi_ctx_regs[i], val);
+	}
+	regcache_cache_only(priv->map, false);
+	
+	return 0;
+}
+
 int elv_mipi_dsi_probe(struct platform_device *pdev)
 {
 	struct resource *res;
+	struct elv_mipi_dsi_priv *priv;
 	struct elv_mipi_dsi *dsi;
 	/*struct mipi_dsi_config *dsi_config;*/
 	int ret = -EINVAL;
@@ -682,17 +3118,28 @@ int elv_mipi_dsi_probe(struct platform_device *pdev)
 	struct device_node *np;
 	struct device_node *spi_node;
     struct spi_device *spi;
+	ktime_t start;
+	struct elv_dsi_cost cost;
+	bool handoff;
+	struct kernfs_node *kn;
 
 	//dev_info(&pdev->dev, "MIPI DSI probe...\n");	
 
-	dsi = devm_kzalloc(&pdev->dev, sizeof(struct elv_mipi_dsi),
+	priv = devm_kzalloc(&pdev->dev, sizeof(struct elv_mipi_dsi_priv),
 				GFP_KERNEL);
-	if (!dsi) {
+	if (!priv) {
 		dev_err(&pdev->dev, "Failed to allocate DSI object!\n");
 		return -ENOMEM;
 	}
+	dsi = &priv->dsi;
 			
 	dsi->dev = &pdev->dev;	
+	mutex_init(&priv->lock);
+	INIT_DELAYED_WORK(&priv->recover_work, elv_mipi_dsi_recover_work);
+	INIT_DELAYED_WORK(&priv->link_work, elv_mipi_dsi_link_work);
+	init_completion(&priv->read_done);
+	spin_lock_init(&priv->vblank_lock);
+	init_waitqueue_head(&priv->vblank_wait);
 	
 	np = dsi->dev->of_node;
 	
@@ -716,63 +3163,164 @@ int elv_mipi_dsi_probe(struct platform_device *pdev)
 		return ret;
 	}
 	
+	ret = elv_mipi_dsi_parse_dt(dsi);
+	if (ret)
+		return ret;
+	
 	dsi->irq = platform_get_irq(pdev, 0);
 	if (IS_ERR_VALUE(dsi->irq)) {
 		dev_err(&pdev->dev, "Failed to request DSI irq resource\n");
 		return -EINVAL;
 	}
 
-	ret = devm_request_irq(&pdev->dev, dsi->irq, dsi_irq_handler,
-			       0, "elvees-mipi-dsi", dsi);
-	if (ret) {
-		dev_err(&pdev->dev, "Cannot request irq handler\n");
-		return ret;
-	}
-	
 	dsi->dphy_clk = devm_clk_get(&pdev->dev, NULL);
 	if (IS_ERR(dsi->dphy_clk)) {
 		dev_err(&pdev->dev, "Failed to get D-PHY clock\n");
 		return -ENOMEM;
 	}	
 
+	/* pixclk видеовыхода нужен только для смены частоты кадров */
+	priv->pclk = devm_clk_get(&pdev->dev, "pclk");
+	if (IS_ERR(priv->pclk))
+		priv->pclk = NULL;
+
 	ret = clk_prepare_enable(dsi->dphy_clk);
 	if (ret < 0) {
 		dev_err(&pdev->dev, "Could not prepare or enable D-PHY clock\n");
-		clk_put(dsi->dphy_clk);
-		goto error;
+		return ret;
 	}	
 	/* else {
 		clk_rate = clk_get_rate(dsi->dphy_clk);
 		dev_info(&pdev->dev, "D-PHY clk enabled: %lu\n", clk_rate);
 	}*/
 		
-	elv_mipi_dsi_init_dsi(dsi);
+	ret = elv_mipi_dsi_init_regmap(dsi);
+	if (ret) {
+		dev_err(&pdev->dev, "Failed to init regmap: %d\n", ret);
+		goto err_clk;
+	}
+	
+	/* Обработчик читает регистры через regmap, поэтому после его создания */
+	ret = devm_request_irq(&pdev->dev, dsi->irq, dsi_irq_handler,
+			       0, "elvees-mipi-dsi", dsi);
+	if (ret) {
+		dev_err(&pdev->dev, "Cannot request irq handler\n");
+		goto err_clk;
+	}
+	
+	start = ktime_get();
+	cost = dsi_seq_start(priv);
+	handoff = elv_mipi_dsi_init_dsi(dsi);
+	dsi_seq_end(priv, DSI_SEQ_INIT, cost);
+	dev_info(&pdev->dev, "%s in %lld us\n",
+		 handoff ? "bootloader configuration adopted" : "link initialised",
+		 ktime_us_delta(ktime_get(), start));
+	elv_mipi_dsi_init_refresh(dsi);
+	
+	dev_info(&pdev->dev, "%ux%u, %u lanes, %s, %s video mode, ddr_clk %u MHz, HS active %u of %u byteclk per line\n",
+		priv->vm.hactive, priv->vm.vactive, priv->lanes, priv->format->name,
+		priv->burst_mode ? "burst" : "non-burst", priv->timings.ddr_mhz, priv->timings.haa,
+		priv->timings.hsync + priv->timings.hbp + priv->timings.haa + priv->timings.hfp);
+	dev_info(&pdev->dev, "PLL div_ratio %u, required %u kHz, margin %u.%u%%, LP window %u byteclk\n",
+		priv->timings.div_ratio, priv->timings.req_khz,
+		elv_mipi_dsi_pll_margin(&priv->timings) / 10,
+		elv_mipi_dsi_pll_margin(&priv->timings) % 10, priv->timings.lp_window);
 	
 	platform_set_drvdata(pdev, dsi);
 	
+	/* dphy_clk уже включён, дальше им управляет runtime PM */
+	priv->rpm_stamp = ktime_get();
+	pm_runtime_set_active(&pdev->dev);
+	pm_runtime_set_autosuspend_delay(&pdev->dev, dsi_autosuspend_delay * 1000);
+	pm_runtime_use_autosuspend(&pdev->dev);
+	pm_runtime_get_noresume(&pdev->dev);
+	pm_runtime_enable(&pdev->dev);
+	pm_runtime_mark_last_busy(&pdev->dev);
+	pm_runtime_put_autosuspend(&pdev->dev);
+	
 	dsi_debugfs_init(dsi);
 	
+	/* Панели - дочерние узлы DT, после регистрации им доступен mipi_dsi_dcs_write() */
+	priv->host.dev = &pdev->dev;
+	priv->host.ops = &elv_mipi_dsi_host_ops;
+	ret = mipi_dsi_host_register(&priv->host);
+	if (ret) {
+		dev_err(&pdev->dev, "Failed to register DSI host: %d\n", ret);
+		goto err_pm;
+	}
+	
+	/* После регистрации панель может вызвать elv_mipi_dsi_frame_activity() */
+	ret = elv_mipi_dsi_init_cmd_mode(dsi);
+	if (ret)
+		goto err_host;
+	
 	ret = sysfs_create_group(&pdev->dev.kobj, &elv_mipi_dsi_attr_group);
     if (ret) {
         dev_err(&pdev->dev, "sysfs creation elv_mipi_dsi failed\n");
-        return ret;
+        goto err_host;
     }
+	
+	kn = sysfs_get_dirent(pdev->dev.kobj.sd, elv_mipi_dsi_attr_group.name);
+	if (kn) {
+		priv->vblank_kn = sysfs_get_dirent(kn, "vblank");
+		sysfs_put(kn);
+	}
+	
+	/*
+	 * Таймер простоя и контроль качества линка запускаются последними,
+	 * когда откатывать уже нечего
+	 */
+	if (priv->pclk && priv->idle_timeout_ms && priv->idle_refresh)
+		mod_delayed_work(system_wq, &priv->idle_work,
+				 msecs_to_jiffies(priv->idle_timeout_ms));
+	if (priv->link_interval_ms)
+		schedule_delayed_work(&priv->link_work,
+				      msecs_to_jiffies(priv->link_interval_ms));
 
 	//dev_info(&pdev->dev, "%s() completed successfully\n", __func__);
 	dev_info(&pdev->dev, "MIPI DSI driver loaded successfully\n");
 
 	return 0;
 
-error:
-	clk_disable(dsi->dphy_clk);
+	/* Откат в порядке, обратном probe; display-timings освобождает devm */
+err_host:
+	mipi_dsi_host_unregister(&priv->host);
+	cancel_delayed_work_sync(&priv->idle_work);
+	cancel_work_sync(&priv->wake_work);
+err_pm:
+	dsi_debugfs_remove(dsi);
+	pm_runtime_get_sync(&pdev->dev);
+	pm_runtime_disable(&pdev->dev);
+	pm_runtime_dont_use_autosuspend(&pdev->dev);
+	pm_runtime_put_noidle(&pdev->dev);
+	disable_irq(dsi->irq);
+	cancel_delayed_work_sync(&priv->recover_work);
+err_clk:
+	elv_mipi_dsi_dphy_clk_off(dsi);
 	return ret;
 }
 
 int elv_mipi_dsi_remove(struct platform_device *pdev)
 {
 	struct elv_mipi_dsi *dsi = platform_get_drvdata(pdev);
+	struct elv_mipi_dsi_priv *priv = to_dsi_priv(dsi);
 	
-	clk_disable(dsi->dphy_clk);
+	mipi_dsi_host_unregister(&priv->host);
+	disable_irq(dsi->irq);
+	if (priv->te_gpio)
+		disable_irq(gpiod_to_irq(priv->te_gpio));
+	if (priv->vblank_kn)
+		sysfs_put(priv->vblank_kn);
+	priv->vblank_kn = NULL;
+	cancel_delayed_work_sync(&priv->recover_work);
+	cancel_delayed_work_sync(&priv->link_work);
+	cancel_delayed_work_sync(&priv->idle_work);
+	cancel_work_sync(&priv->wake_work);
+	pm_runtime_get_sync(&pdev->dev);
+	pm_runtime_disable(&pdev->dev);
+	pm_runtime_dont_use_autosuspend(&pdev->dev);
+	pm_runtime_put_noidle(&pdev->dev);
+	elv_mipi_dsi_dphy_clk_off(dsi);
 	dsi_debugfs_remove(dsi);
 	sysfs_remove_group(&pdev->dev.kobj, &elv_mipi_dsi_attr_group);
 	return 0;
@@ -8,7 +8,11 @@
 #include <linux/of.h>
 #include <linux/of_device.h>
 #include <linux/io.h>
+#include <linux/iopoll.h>
+#include <linux/pm_domain.h>
 #include <linux/sysfs.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
 
 #ifdef CONFIG_DEBUG_FS
 #include <linux/debugfs.h>
@@ -42,15 +46,35 @@
 
 #define DSP_UP						(1 << 1)
 #define VPU_UP						(1 << 2)
+#define GPU_UP						(1 << 3)
 #define DSP_DOWN					(1 << 1)
 #define VPU_DOWN					(1 << 2)
+#define GPU_DOWN					(1 << 3)
+
+#define PMCTR_PWR_TIMEOUT_US		10000
+#define PMCTR_BENCH_CYCLES			100
+
+struct mcom_pmctr;
+
+struct mcom_pmctr_domain {
+	struct generic_pm_domain genpd;
+	struct mcom_pmctr *pmctr;
+	u32 bit;
+	bool on;			/* домен включён по запросу genpd */
+};
+
+#define to_mcom_pmctr_domain(gpd) \
+	container_of(gpd, struct mcom_pmctr_domain, genpd)
 
 struct mcom_pmctr {
 	struct device *dev;
 	void __iomem *reg_base;
+	struct mutex lock;		/* переходы доменов CORE_PWR */
 	int dsp_vpu_pwr_state;
+	struct mcom_pmctr_domain *gpu_pd;
 #ifdef CONFIG_DEBUG_FS
 	struct dentry *debugfs;
+	u32 bench_cycles;
 #endif	
 
 };
@@ -65,6 +89,29 @@ static inline u32 pmctr_read(struct mcom_pmctr *pmctr, u32 reg)
 	return ioread32(pmctr->reg_base + reg);
 }
 
+#define pmctr_core_pwr_done(status, bit, on) \
+	((on) ? ((status) & (bit)) : !((status) & (bit)))
+
+static void pmctr_core_pwr_start(struct mcom_pmctr *pmctr, u32 bit, bool on)
+{
+	if (on)
+		pmctr_write(pmctr, PMCTR_CORE_PWR_UP_REG, bit);
+	else
+		pmctr_write(pmctr, PMCTR_CORE_PWR_DOWN_REG, bit);
+}
+
+/* Запуск перехода домена CORE_PWR и ожидание подтверждения в STATUS */
+static int pmctr_core_pwr_set(struct mcom_pmctr *pmctr, u32 bit, bool on)
+{
+	u32 status;
+
+	pmctr_core_pwr_start(pmctr, bit, on);
+
+	return readl_poll_timeout(pmctr->reg_base + PMCTR_CORE_PWR_STATUS_REG,
+			status, pmctr_core_pwr_done(status, bit, on),
+			1, PMCTR_PWR_TIMEOUT_US);
+}
+
 #ifdef CONFIG_DEBUG_FS
 #define PMCTR_REGS_BUFSIZE	2048
 static ssize_t pmctr_show_regs(struct file *file, char __user *user_buf,
@@ -138,6 +185,181 @@ static const struct file_operations pmctr_regs_ops = {
 	.llseek		= default_llseek,
 };
 
+struct pmctr_bench_domain {
+	const char *name;
+	u32 bit;
+};
+
+static const struct pmctr_bench_domain pmctr_bench_domains[] = {
+	{ "dsp", DSP_UP },
+	{ "vpu", VPU_UP },
+	{ "gpu", GPU_UP },
+};
+
+struct pmctr_bench_result {
+	s64 up_min, up_max, up_sum;
+	s64 down_min, down_max, down_sum;
+	u32 istat;
+	u32 cycles;
+	int err;
+};
+
+static void pmctr_bench_account(s64 t, s64 *min, s64 *max, s64 *sum)
+{
+	if (*min < 0 || t < *min)
+		*min = t;
+	if (t > *max)
+		*max = t;
+	*sum += t;
+}
+
+/*
+ * Замеряемый переход: STATUS опрашивается без засыпания, иначе в результат
+ * попадает гранулярность таймеров и планировщика, а не время переключения.
+ */
+static s64 pmctr_bench_step(struct mcom_pmctr *pmctr, u32 bit, bool on)
+{
+	ktime_t start;
+	u32 status;
+	int ret;
+
+	start = ktime_get();
+	pmctr_core_pwr_start(pmctr, bit, on);
+	ret = readl_poll_timeout_atomic(pmctr->reg_base + PMCTR_CORE_PWR_STATUS_REG,
+			status, pmctr_core_pwr_done(status, bit, on),
+			0, PMCTR_PWR_TIMEOUT_US);
+	if (ret)
+		return ret;
+
+	return ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+/*
+ * Домен считается занятым, если он включён: драйвером GPU через genpd,
+ * записью в dsp_vpu_pwr или драйверами DSP/VPU. Вызывается под pmctr->lock.
+ */
+static bool pmctr_bench_busy(struct mcom_pmctr *pmctr, u32 bit)
+{
+	if (bit == GPU_UP && (!pmctr->gpu_pd || pmctr->gpu_pd->on))
+		return true;
+
+	if (bit != GPU_UP && pmctr->dsp_vpu_pwr_state)
+		return true;
+
+	return pmctr_read(pmctr, PMCTR_CORE_PWR_STATUS_REG) & bit;
+}
+
+/* Циклирует выключенный домен n раз и оставляет его выключенным */
+static void pmctr_bench_domain(struct mcom_pmctr *pmctr, u32 bit, u32 n,
+		struct pmctr_bench_result *res)
+{
+	s64 t;
+	u32 i;
+
+	memset(res, 0, sizeof(*res));
+	res->up_min = -1;
+	res->down_min = -1;
+
+	pmctr_write(pmctr, PMCTR_CORE_PWR_ICLR_REG, bit);
+
+	for (i = 0; i < n; i++) {
+		t = pmctr_bench_step(pmctr, bit, true);
+		if (t < 0) {
+			res->err = t;
+			break;
+		}
+		pmctr_bench_account(t, &res->up_min, &res->up_max, &res->up_sum);
+
+		t = pmctr_bench_step(pmctr, bit, false);
+		if (t < 0) {
+			res->err = t;
+			break;
+		}
+		pmctr_bench_account(t, &res->down_min, &res->down_max, &res->down_sum);
+
+		res->cycles++;
+	}
+
+	res->istat = pmctr_read(pmctr, PMCTR_CORE_PWR_ISTAT_REG) & bit;
+	pmctr_write(pmctr, PMCTR_CORE_PWR_ICLR_REG, bit);
+
+	if (res->err)
+		pmctr_core_pwr_set(pmctr, bit, false);
+}
+
+static ssize_t pmctr_show_bench(struct file *file, char __user *user_buf,
+		size_t count, loff_t *ppos)
+{
+	struct mcom_pmctr *pmctr = file->private_data;
+	struct pmctr_bench_result res;
+	char *buf;
+	u32 len = 0;
+	ssize_t ret;
+	int i;
+
+	/* Замеры выполняются только при первом чтении файла */
+	if (*ppos)
+		return 0;
+
+	if (!pmctr->bench_cycles)
+		return -EINVAL;
+
+	buf = kzalloc(PMCTR_REGS_BUFSIZE, GFP_KERNEL);
+	if (!buf)
+		return 0;
+
+	len += snprintf(buf + len, PMCTR_REGS_BUFSIZE - len,
+			"cycles: %u, CORE_PWR_DELAY: 0x%08x, SYS_PWR_DELAY: 0x%08x\n",
+			pmctr->bench_cycles,
+			pmctr_read(pmctr, PMCTR_CORE_PWR_DELAY_REG),
+			pmctr_read(pmctr, PMCTR_SYS_PWR_DELAY_REG));
+	len += snprintf(buf + len, PMCTR_REGS_BUFSIZE - len,
+			"domain\tup min/avg/max, ns\tdown min/avg/max, ns\tistat\n");
+
+	for (i = 0; i < ARRAY_SIZE(pmctr_bench_domains); i++) {
+		const struct pmctr_bench_domain *d = &pmctr_bench_domains[i];
+
+		/*
+		 * Включённые домены не трогаем. pmctr->lock держится весь замер:
+		 * запрос genpd на включение GPU дождётся его окончания.
+		 */
+		mutex_lock(&pmctr->lock);
+		if (pmctr_bench_busy(pmctr, d->bit)) {
+			mutex_unlock(&pmctr->lock);
+			len += snprintf(buf + len, PMCTR_REGS_BUFSIZE - len,
+					"%s\tbusy, skipped\n", d->name);
+			continue;
+		}
+
+		pmctr_bench_domain(pmctr, d->bit, pmctr->bench_cycles, &res);
+		mutex_unlock(&pmctr->lock);
+
+		if (!res.cycles) {
+			len += snprintf(buf + len, PMCTR_REGS_BUFSIZE - len,
+					"%s\terror %d\n", d->name, res.err);
+			continue;
+		}
+
+		len += snprintf(buf + len, PMCTR_REGS_BUFSIZE - len,
+				"%s\t%lld/%lld/%lld\t\t%lld/%lld/%lld\t\t0x%x%s\n",
+				d->name,
+				res.up_min, div_s64(res.up_sum, res.cycles), res.up_max,
+				res.down_min, div_s64(res.down_sum, res.cycles), res.down_max,
+				res.istat, res.err ? " (timeout)" : "");
+	}
+
+	ret = simple_read_from_buffer(user_buf, count, ppos, buf, len);
+	kfree(buf);
+	return ret;
+}
+
+static const struct file_operations pmctr_bench_ops = {
+	.owner		= THIS_MODULE,
+	.open		= simple_open,
+	.read		= pmctr_show_bench,
+	.llseek		= default_llseek,
+};
+
 static int pmctr_debugfs_init(struct mcom_pmctr *pmctr)
 {
 	pmctr->debugfs = debugfs_create_dir("mcom_pmctr", NULL);	
@@ -146,6 +368,12 @@ static int pmctr_debugfs_init(struct mcom_pmctr *pmctr)
 
 	debugfs_create_file("registers", S_IFREG | S_IRUGO,
 		pmctr->debugfs, (void *)pmctr, &pmctr_regs_ops);
+
+	pmctr->bench_cycles = PMCTR_BENCH_CYCLES;
+	debugfs_create_u32("bench_cycles", S_IRUGO | S_IWUSR,
+		pmctr->debugfs, &pmctr->bench_cycles);
+	debugfs_create_file("benchmark", S_IFREG | S_IRUSR,
+		pmctr->debugfs, (void *)pmctr, &pmctr_bench_ops);
 	return 0;
 }
 
@@ -175,6 +403,68 @@ static void dsp_vpu_pwr_down(struct mcom_pmctr *pmctr)
 	pmctr_write(pmctr, PMCTR_CORE_PWR_DOWN_REG, (DSP_DOWN | VPU_DOWN));
 }
 
+/* Домен Mali-300: включается/выключается через runtime PM драйвера GPU */
+static int mcom_pmctr_domain_set(struct mcom_pmctr_domain *pd, bool on)
+{
+	int ret;
+
+	mutex_lock(&pd->pmctr->lock);
+	ret = pmctr_core_pwr_set(pd->pmctr, pd->bit, on);
+	if (!ret)
+		pd->on = on;
+	mutex_unlock(&pd->pmctr->lock);
+	if (ret)
+		dev_err(pd->pmctr->dev, "%s: power %s timeout\n",
+			pd->genpd.name, on ? "up" : "down");
+
+	return ret;
+}
+
+static int mcom_pmctr_domain_power_on(struct generic_pm_domain *genpd)
+{
+	return mcom_pmctr_domain_set(to_mcom_pmctr_domain(genpd), true);
+}
+
+static int mcom_pmctr_domain_power_off(struct generic_pm_domain *genpd)
+{
+	return mcom_pmctr_domain_set(to_mcom_pmctr_domain(genpd), false);
+}
+
+/*
+ * В 4.4 нет pm_genpd_remove(): после pm_genpd_init() домен навсегда остаётся
+ * в глобальном списке genpd. Поэтому память домена выделяется без devm и не
+ * освобождается, модуль удерживается, а отвязка устройства через sysfs
+ * запрещена (suppress_bind_attrs), чтобы pmctr оставался живым.
+ */
+static int mcom_pmctr_gpu_domain_init(struct mcom_pmctr *pmctr)
+{
+	struct mcom_pmctr_domain *pd;
+	bool is_off;
+	int ret;
+
+	pd = kzalloc(sizeof(*pd), GFP_KERNEL);
+	if (!pd)
+		return -ENOMEM;
+
+	pd->pmctr = pmctr;
+	pd->bit = GPU_UP;
+	pd->genpd.name = "mali";
+	pd->genpd.power_on = mcom_pmctr_domain_power_on;
+	pd->genpd.power_off = mcom_pmctr_domain_power_off;
+
+	is_off = !(pmctr_read(pmctr, PMCTR_CORE_PWR_STATUS_REG) & GPU_UP);
+	pd->on = !is_off;
+	pm_genpd_init(&pd->genpd, NULL, is_off);
+	pmctr->gpu_pd = pd;
+	__module_get(THIS_MODULE);
+
+	ret = of_genpd_add_provider_simple(pmctr->dev->of_node, &pd->genpd);
+	if (ret)
+		dev_err(pmctr->dev, "Failed to register GPU power domain\n");
+
+	return ret;
+}
+
 static ssize_t mcom_pmctr_dsp_vpu_pwr_show(struct device *dev,
         struct device_attribute *attr, char *buf)
 {
@@ -199,6 +489,7 @@ static ssize_t mcom_pmctr_dsp_vpu_pwr_store(struct device *dev,
     if (ret)
 		return ret;
 	
+	mutex_lock(&pmctr->lock);
 	if (val == 1) {
 		dsp_vpu_pwr_up(pmctr);
 		pmctr->dsp_vpu_pwr_state = 1;
@@ -208,18 +499,74 @@ static ssize_t mcom_pmctr_dsp_vpu_pwr_store(struct device *dev,
 		pmctr->dsp_vpu_pwr_state = 0;
 	}
 	else {
+		mutex_unlock(&pmctr->lock);
 		dev_err(dev, "Invalid value: %lu\n", val);
 		return -ENXIO;
 	}
+	mutex_unlock(&pmctr->lock);
 			
     return count;
 }
 
 static DEVICE_ATTR(dsp_vpu_pwr, S_IRUGO | S_IWUSR, mcom_pmctr_dsp_vpu_pwr_show,
                    mcom_pmctr_dsp_vpu_pwr_store);
+
+static ssize_t mcom_pmctr_delay_show(struct mcom_pmctr *pmctr, u32 reg, char *buf)
+{
+    return sprintf(buf, "0x%08x\n", pmctr_read(pmctr, reg));
+}
+
+static ssize_t mcom_pmctr_delay_store(struct mcom_pmctr *pmctr, u32 reg,
+        const char *buf, size_t count)
+{
+    int ret;
+    u32 val;
+
+    ret = kstrtou32(buf, 0, &val);
+    if (ret)
+		return ret;
+
+	pmctr_write(pmctr, reg, val);
+    return count;
+}
+
+static ssize_t mcom_pmctr_core_pwr_delay_show(struct device *dev,
+        struct device_attribute *attr, char *buf)
+{
+    return mcom_pmctr_delay_show(dev_get_drvdata(dev),
+                                 PMCTR_CORE_PWR_DELAY_REG, buf);
+}
+
+static ssize_t mcom_pmctr_core_pwr_delay_store(struct device *dev,
+        struct device_attribute *attr, const char *buf, size_t count)
+{
+    return mcom_pmctr_delay_store(dev_get_drvdata(dev),
+                                  PMCTR_CORE_PWR_DELAY_REG, buf, count);
+}
+
+static ssize_t mcom_pmctr_sys_pwr_delay_show(struct device *dev,
+        struct device_attribute *attr, char *buf)
+{
+    return mcom_pmctr_delay_show(dev_get_drvdata(dev),
+                                 PMCTR_SYS_PWR_DELAY_REG, buf);
+}
+
+static ssize_t mcom_pmctr_sys_pwr_delay_store(struct device *dev,
+        struct device_attribute *attr, const char *buf, size_t count)
+{
+    return mcom_pmctr_delay_store(dev_get_drvdata(dev),
+                                  PMCTR_SYS_PWR_DELAY_REG, buf, count);
+}
+
+static DEVICE_ATTR(core_pwr_delay, S_IRUGO | S_IWUSR, mcom_pmctr_core_pwr_delay_show,
+                   mcom_pmctr_core_pwr_delay_store);
+static DEVICE_ATTR(sys_pwr_delay, S_IRUGO | S_IWUSR, mcom_pmctr_sys_pwr_delay_show,
+                   mcom_pmctr_sys_pwr_delay_store);
                    
 static struct attribute *mcom_pmctr_attrs[] = {
     &dev_attr_dsp_vpu_pwr.attr,
+    &dev_attr_core_pwr_delay.attr,
+    &dev_attr_sys_pwr_delay.attr,
     NULL
 };
 
@@ -228,6 +575,19 @@ static struct attribute_group mcom_pmctr_attr_group = {
     .attrs = mcom_pmctr_attrs,
 };
 
+/* Задержки переходов питания задаются в DT под конкретную ревизию платы */
+static void mcom_pmctr_parse_dt(struct mcom_pmctr *pmctr)
+{
+	struct device_node *np = pmctr->dev->of_node;
+	u32 val;
+
+	if (!of_property_read_u32(np, "elvees,core-pwr-delay", &val))
+		pmctr_write(pmctr, PMCTR_CORE_PWR_DELAY_REG, val);
+
+	if (!of_property_read_u32(np, "elvees,sys-pwr-delay", &val))
+		pmctr_write(pmctr, PMCTR_SYS_PWR_DELAY_REG, val);
+}
+
 int mcom_pmctr_probe(struct platform_device *pdev)
 {
 	struct resource *res;
@@ -244,6 +604,7 @@ int mcom_pmctr_probe(struct platform_device *pdev)
 	}
 			
 	pmctr->dev = &pdev->dev;
+	mutex_init(&pmctr->lock);
 	
 	res = platform_get_resource(pdev, IORESOURCE_MEM, 0);
 
@@ -255,14 +616,25 @@ int mcom_pmctr_probe(struct platform_device *pdev)
 	
 	platform_set_drvdata(pdev, pmctr);
 	
+	mcom_pmctr_parse_dt(pmctr);
+	
 	pmctr_debugfs_init(pmctr);
 	
 	ret = sysfs_create_group(&pdev->dev.kobj, &mcom_pmctr_attr_group);
     if (ret) {
         dev_err(&pdev->dev, "sysfs creation mcom_pmctr failed\n");
+        pmctr_debugfs_remove(pmctr);
         return ret;
     }
 	
+	/*
+	 * Домен GPU регистрируется последним: зарегистрированный genpd нельзя
+	 * убрать, поэтому ошибка провайдера не проваливает probe - иначе devm
+	 * освободил бы pmctr, на который ссылается домен.
+	 */
+	if (mcom_pmctr_gpu_domain_init(pmctr))
+		dev_err(&pdev->dev, "GPU power domain is not available\n");
+	
 	dev_info(&pdev->dev, "PMCTR demo driver loaded successfully!\n");
 
 	return 0;
@@ -273,6 +645,7 @@ int mcom_pmctr_remove(struct platform_device *pdev)
 {
 	struct mcom_pmctr *pmctr = platform_get_drvdata(pdev);
 	
+	of_genpd_del_provider(pdev->dev.of_node);
 	pmctr_debugfs_remove(pmctr);
 	sysfs_remove_group(&pdev->dev.kobj, &mcom_pmctr_attr_group);
 	return 0;
@@ -290,6 +663,7 @@ static struct platform_driver mcom_pmctr_driver = {
 	.remove = mcom_pmctr_remove,
 	.driver = {
 		   .name = "pmctr",
+		   .suppress_bind_attrs = true,
 		   .of_match_table = of_match_ptr(mcom_pmctr_of_match),
 	},
 };
@@ -6,6 +6,7 @@
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/delay.h>
+#include <linux/ktime.h>
 
 #include <linux/gpio/consumer.h>
 #include <linux/regulator/consumer.h>
@@ -50,6 +51,20 @@
 #define READ_MEM     	0x3e
 #define GET_POWER_MODE 	0x0a
 
+// В 9-битном слове SPI бит 8 - признак D/C: 0 - команда, 1 - параметр
+#define HX8369A_SPI_DC_DATA	BIT(8)
+
+// Пакет инициализации: не больше 16 команд и 256 байт команд и параметров
+#define HX8369A_BATCH_XFERS	16
+#define HX8369A_BATCH_BYTES	512
+
+// Пауза после загрузки гамма-кривой
+#define HX8369A_GAMMA_DELAY_US	10000
+
+static bool batch_init = true;
+module_param(batch_init, bool, 0644);
+MODULE_PARM_DESC(batch_init, "send panel init sequence in one SPI message");
+
 enum hx8369a_mpu_interface {
 	HX8369A_DBI_TYPE_A_8BIT,
 	HX8369A_DBI_TYPE_A_9BIT,
@@ -78,6 +93,19 @@ enum hx8369a_resolution {
 	HX8369A_RES_DISABLE
 };
 
+/*
+ * Последовательность инициализации, собранная в одно сообщение SPI:
+ * каждая команда - отдельная передача, CS снимается между командами
+ */
+struct hx8369a_batch {
+	struct spi_message msg;
+	struct spi_transfer xfer[HX8369A_BATCH_XFERS];
+	u8 buf[HX8369A_BATCH_BYTES];
+	int nxfer;
+	int used;
+	int err;
+};
+
 struct hx8369a {
 	struct device *dev;
 	struct spi_device *spi;
@@ -93,6 +121,17 @@ struct hx8369a {
 	int pixel_format;	// цветность изображения, bits per pixel
 	struct videomode vm;// не используется 
 	u8 res_sel;			// разрешение дисплея
+	bool word9;			// контроллер SPI передаёт 9-битные слова, D/C в бите 8
+	struct hx8369a_batch *batch;	// собираемый пакет инициализации или NULL
+
+	u32 spi_cmds;		// счётчики команд, вызовов spi_sync и бит на линии
+	u32 spi_syncs;
+	u32 spi_bits;
+
+	u32 init_cmds;		// стоимость последней инициализации
+	u32 init_syncs;
+	u32 init_bits;
+	u32 init_us;
 };
 
 u8 read_temp_cmd[] = {SETTEMP,
@@ -100,49 +139,152 @@ u8 read_temp_cmd[] = {SETTEMP,
 					0xA7, 0x09, 0x67, 0x50,
 					0x4E, 0x17, 0x75};
 
+/*
+ * Упаковка команды и параметров в 9-битные слова: признак D/C передаётся
+ * девятым битом слова, а не отдельным байтом, поэтому по линии уходит
+ * вдвое меньше тактов, чем при 8-битных словах
+ */
+static void hx8369a_spi_pack_words(u16 *words, const u8 *txbuf, u16 txlen)
+{
+	int i;
+
+	for (i = 0; i < txlen; i++)
+		words[i] = (i ? HX8369A_SPI_DC_DATA : 0) | txbuf[i];
+}
+
+// Упаковка в 8-битные слова: перед каждым байтом отдельный байт D/C
+static void hx8369a_spi_pack_bytes(u8 *buf, const u8 *txbuf, u16 txlen)
+{
+	int i;
+
+	for (i = 0; i < txlen; i++) {
+		buf[2 * i] = i ? 1 : 0;
+		buf[2 * i + 1] = txbuf[i];
+	}
+}
+
+/*
+ * Биты на линии: 9-битное слово занимает в буфере два байта, поэтому
+ * frame_length сообщения для подсчёта не годится
+ */
+static u32 hx8369a_spi_wire_bits(struct hx8369a *dsi_panel, struct spi_message *msg)
+{
+	struct spi_transfer *xfer;
+	u32 bits = 0, bpw;
+
+	list_for_each_entry(xfer, &msg->transfers, transfer_list) {
+		bpw = xfer->bits_per_word ? : dsi_panel->spi->bits_per_word ? : 8;
+		bits += xfer->len / DIV_ROUND_UP(bpw, 8) * bpw;
+	}
+
+	return bits;
+}
+
+static int hx8369a_spi_sync(struct hx8369a *dsi_panel, struct spi_message *msg)
+{
+	int ret;
+
+	ret = spi_sync(dsi_panel->spi, msg);
+	dsi_panel->spi_syncs++;
+	if (ret == 0)
+		dsi_panel->spi_bits += hx8369a_spi_wire_bits(dsi_panel, msg);
+
+	return ret;
+}
+
 static int hx8369a_spi_write_then_read(struct hx8369a *dsi_panel,
 				u8 *txbuf, u16 txlen,
 				u8 *rxbuf, u16 rxlen)
 {
-	struct spi_device *spi = dsi_panel->spi;
 	struct spi_message msg;
 	struct spi_transfer xfer;
 	u8 *local_txbuf = NULL;
-	int ret = 0, j=0;
+	u16 *local_words = NULL;
+	int ret = 0;
 
 	memset(&xfer, 0, sizeof(xfer));
 	spi_message_init(&msg);
 
-	if (txlen) {
-		int i;
+	if (txlen && dsi_panel->word9) {
+		local_words = kcalloc(txlen, sizeof(*local_words), GFP_KERNEL);
+		if (!local_words)
+			return -ENOMEM;
 
+		hx8369a_spi_pack_words(local_words, txbuf, txlen);
+
+		xfer.len = txlen * sizeof(*local_words);
+		xfer.bits_per_word = 9;
+		xfer.tx_buf = local_words;
+		spi_message_add_tail(&xfer, &msg);
+	} else if (txlen) {
 		local_txbuf = kcalloc(txlen*2, sizeof(*local_txbuf), GFP_KERNEL);		
 
 		if (!local_txbuf)
 			return -ENOMEM;
 
-		for (i = 0; i < txlen; i++) {
-			if (i == 0) {
-				local_txbuf[j] = 0; j++;
-				local_txbuf[j] = txbuf[i]; j++; 
-			} else {
-				local_txbuf[j] = 1; j++;
-				local_txbuf[j] = txbuf[i]; j++;
-			}
-		}
+		hx8369a_spi_pack_bytes(local_txbuf, txbuf, txlen);
 
 		xfer.len = 2*txlen;
 		xfer.bits_per_word = 8;
 		xfer.tx_buf = local_txbuf;
 		spi_message_add_tail(&xfer, &msg);
 	}
+
+	if (txlen)
+		dsi_panel->spi_cmds++;
 	
-	ret = spi_sync(spi, &msg);
+	ret = hx8369a_spi_sync(dsi_panel, &msg);
 	if (ret < 0)
 		dev_err(dsi_panel->dev, "Couldn't send SPI data\n");
 
-	if (txlen)
+	if (txlen) {
 		kfree(local_txbuf);
+		kfree(local_words);
+	}
+
+	return ret;
+}
+
+/*
+ * Чтение в режиме 9-битных слов: команда и параметры уходят 9-битными
+ * словами, ответ панели принимается отдельной передачей по 8 бит
+ */
+static int hx8369a_spi_read_words(struct hx8369a *dsi_panel,
+				u8 *txbuf, u8 txlen,
+				u8 *rxbuf, u8 rxlen)
+{
+	struct spi_message msg;
+	struct spi_transfer xfer[2];
+	u16 *local_words;
+	int ret;
+
+	memset(xfer, 0, sizeof(xfer));
+	spi_message_init(&msg);
+
+	local_words = kcalloc(txlen, sizeof(*local_words), GFP_KERNEL);
+	if (!local_words)
+		return -ENOMEM;
+
+	hx8369a_spi_pack_words(local_words, txbuf, txlen);
+	dsi_panel->spi_cmds++;
+
+	xfer[0].len = txlen * sizeof(*local_words);
+	xfer[0].bits_per_word = 9;
+	xfer[0].tx_buf = local_words;
+	spi_message_add_tail(&xfer[0], &msg);
+
+	if (rxlen) {
+		xfer[1].len = rxlen;
+		xfer[1].bits_per_word = 8;
+		xfer[1].rx_buf = rxbuf;
+		spi_message_add_tail(&xfer[1], &msg);
+	}
+
+	ret = hx8369a_spi_sync(dsi_panel, &msg);
+	if (ret < 0)
+		dev_err(dsi_panel->dev, "Couldn't send SPI data\n");
+
+	kfree(local_words);
 
 	return ret;
 }
@@ -151,7 +293,6 @@ static int hx8369a_spi_write_then_read3(struct hx8369a *dsi_panel,
 				u8 *txbuf, u8 txlen,
 				u8 *rxbuf, u8 rxlen)
 {
-	struct spi_device *spi = dsi_panel->spi;
 	struct spi_message msg;
 	struct spi_transfer xfer;
 	u8 *local_txbuf = NULL;
@@ -161,6 +302,9 @@ static int hx8369a_spi_write_then_read3(struct hx8369a *dsi_panel,
 	memset(&xfer, 0, sizeof(xfer));
 	spi_message_init(&msg);
 
+	if (txlen && dsi_panel->word9)
+		return hx8369a_spi_read_words(dsi_panel, txbuf, txlen, rxbuf, rxlen);
+
 	if (txlen) {		
 
 		local_txbuf = kcalloc((txlen*2+rxlen), sizeof(*local_txbuf), GFP_KERNEL);
@@ -182,6 +326,7 @@ static int hx8369a_spi_write_then_read3(struct hx8369a *dsi_panel,
 		xfer.len = 2*txlen + rxlen;
 		xfer.bits_per_word = 8;
 		xfer.tx_buf = local_txbuf;		
+		dsi_panel->spi_cmds++;
 	}
 	
 	else {
@@ -209,7 +354,7 @@ static int hx8369a_spi_write_then_read3(struct hx8369a *dsi_panel,
 	kfree(str);
 	kfree(str2);*/
 	
-	ret = spi_sync(spi, &msg);
+	ret = hx8369a_spi_sync(dsi_panel, &msg);
 	if (ret < 0)
 		dev_err(dsi_panel->dev, "Couldn't send SPI data\n");
 		
@@ -234,9 +379,85 @@ static inline int hx8369a_spi_write_byte(struct hx8369a *dsi_panel,
 	return hx8369a_spi_write_then_read(dsi_panel, &value, 1, NULL, 0);
 }
 
+static void hx8369a_batch_add(struct hx8369a *dsi_panel, u8 *txbuf, u8 txlen)
+{
+	struct hx8369a_batch *batch = dsi_panel->batch;
+	struct spi_transfer *xfer;
+	u8 *buf = batch->buf + batch->used;
+
+	// в обоих режимах на байт команды приходится два байта буфера
+	BUILD_BUG_ON(HX8369A_BATCH_BYTES % 2);
+
+	if (batch->err)
+		return;
+
+	if (batch->nxfer == HX8369A_BATCH_XFERS ||
+	    batch->used + 2 * txlen > HX8369A_BATCH_BYTES) {
+		dev_err(dsi_panel->dev, "Init sequence does not fit in SPI batch\n");
+		batch->err = -ENOSPC;
+		return;
+	}
+
+	if (dsi_panel->word9)
+		hx8369a_spi_pack_words((u16 *)buf, txbuf, txlen);
+	else
+		hx8369a_spi_pack_bytes(buf, txbuf, txlen);
+
+	xfer = &batch->xfer[batch->nxfer++];
+	xfer->tx_buf = buf;
+	xfer->len = 2 * txlen;
+	xfer->bits_per_word = dsi_panel->word9 ? 9 : 8;
+	xfer->cs_change = 1;	// граница команды
+	spi_message_add_tail(xfer, &batch->msg);
+
+	batch->used += 2 * txlen;
+	dsi_panel->spi_cmds++;
+}
+
+static void hx8369a_batch_begin(struct hx8369a *dsi_panel)
+{
+	struct hx8369a_batch *batch;
+
+	// без памяти под пакет команды уходят по одной
+	batch = kzalloc(sizeof(*batch), GFP_KERNEL);
+	if (!batch)
+		return;
+
+	spi_message_init(&batch->msg);
+	dsi_panel->batch = batch;
+}
+
+static int hx8369a_batch_submit(struct hx8369a *dsi_panel)
+{
+	struct hx8369a_batch *batch = dsi_panel->batch;
+	int ret;
+
+	if (!batch)
+		return 0;
+
+	dsi_panel->batch = NULL;
+
+	ret = batch->err;
+	if (!ret && batch->nxfer) {
+		// после последней передачи CS снимается и без cs_change
+		batch->xfer[batch->nxfer - 1].cs_change = 0;
+
+		ret = hx8369a_spi_sync(dsi_panel, &batch->msg);
+		if (ret < 0)
+			dev_err(dsi_panel->dev, "Couldn't send SPI data\n");
+	}
+
+	kfree(batch);
+
+	return ret;
+}
+
 static void hx8369a_spi_write(struct hx8369a *dsi_panel, u8 *value, u8 len)
 {
-	hx8369a_spi_write_array(dsi_panel, value, len);
+	if (dsi_panel->batch)
+		hx8369a_batch_add(dsi_panel, value, len);
+	else
+		hx8369a_spi_write_array(dsi_panel, value, len);
 }
 
 static inline int hx8369a_spi_read_bytes(struct hx8369a *dsi_panel,
@@ -415,10 +636,9 @@ static void hx8369a_dsi_set_interface_pixel_fomat(struct hx8369a *dsi_panel)
 	hx8369a_spi_write_seq_static(dsi_panel, WRCTRLD, 0x24);
 }*/
 
-static void hx8369a_dsi_panel_init(struct hx8369a *dsi_panel)
+// Команды до гамма-кривой включительно
+static void hx8369a_dsi_init_power(struct hx8369a *dsi_panel)
 {
-	// Последовательность подачи команд (инициализации) взята из документа "TFT480800-16-E APPLICATION NOTE"
-	
 	hx8369a_dsi_set_extension_command(dsi_panel);
 	hx8369a_dsi_set_power(dsi_panel);
 	hx8369a_dsi_set_display_related_register(dsi_panel);
@@ -427,7 +647,11 @@ static void hx8369a_dsi_panel_init(struct hx8369a *dsi_panel)
 	hx8369a_dsi_set_vcom_voltage(dsi_panel);
 	hx8369a_dsi_set_gip(dsi_panel);
 	hx8369a_dsi_set_gamma_curve(dsi_panel);
-	msleep(10);
+}
+
+// Команды после паузы на загрузку гамма-кривой
+static void hx8369a_dsi_init_interface(struct hx8369a *dsi_panel)
+{
 	hx8369a_dsi_set_interface_pixel_fomat(dsi_panel);
 	hx8369a_dsi_set_display_rgb(dsi_panel);
 	hx8369a_dsi_set_temp_control(dsi_panel);
@@ -440,6 +664,52 @@ static void hx8369a_dsi_panel_init(struct hx8369a *dsi_panel)
 	hx8369a_dsi_write_control_display(dsi_panel);*/
 }
 
+/*
+ * Часть последовательности одним сообщением SPI. Если пакет не собрался
+ * или не ушёл, команды повторяются по одной: это запись регистров
+ * панели, повтор безопасен
+ */
+static void hx8369a_dsi_init_part(struct hx8369a *dsi_panel,
+				  void (*part)(struct hx8369a *dsi_panel))
+{
+	int ret;
+
+	if (batch_init)
+		hx8369a_batch_begin(dsi_panel);
+
+	part(dsi_panel);
+
+	ret = hx8369a_batch_submit(dsi_panel);
+	if (ret) {
+		dev_warn(dsi_panel->dev, "SPI batch failed (%d), sending commands one by one\n", ret);
+		part(dsi_panel);
+	}
+}
+
+static void hx8369a_dsi_panel_init(struct hx8369a *dsi_panel)
+{
+	u32 cmds = dsi_panel->spi_cmds;
+	u32 syncs = dsi_panel->spi_syncs;
+	u32 bits = dsi_panel->spi_bits;
+	ktime_t start = ktime_get();
+
+	// Последовательность подачи команд (инициализации) взята из документа "TFT480800-16-E APPLICATION NOTE"
+	
+	hx8369a_dsi_init_part(dsi_panel, hx8369a_dsi_init_power);
+	// пауза между пакетами: delay_usecs занял бы контроллер SPI ожиданием
+	msleep(DIV_ROUND_UP(HX8369A_GAMMA_DELAY_US, 1000));
+	hx8369a_dsi_init_part(dsi_panel, hx8369a_dsi_init_interface);
+
+	dsi_panel->init_us = ktime_us_delta(ktime_get(), start);
+	dsi_panel->init_cmds = dsi_panel->spi_cmds - cmds;
+	dsi_panel->init_syncs = dsi_panel->spi_syncs - syncs;
+	dsi_panel->init_bits = dsi_panel->spi_bits - bits;
+
+	dev_dbg(dsi_panel->dev, "init: %u commands, %u spi_sync, %u bits, %u us\n",
+		dsi_panel->init_cmds, dsi_panel->init_syncs,
+		dsi_panel->init_bits, dsi_panel->init_us);
+}
+
 static int hx8369a_enter_standby(struct hx8369a *dsi_panel)
 {
 	int ret;
@@ -528,6 +798,29 @@ static struct lcd_ops hx8369a_lcd_ops = {
          .set_sleepmode      = hx8369a_lcd_set_sleepmode,
 };
 
+static ssize_t hx8369a_init_stats_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct lcd_device *lcdev = spi_get_drvdata(to_spi_device(dev));
+	struct hx8369a *dp = (struct hx8369a *)lcdev->priv;
+
+	return sprintf(buf, "batch %d\ncommands %u\nspi_sync %u\nbits %u\n"
+		       "time %u us\ntotal commands %u\ntotal spi_sync %u\n",
+		       batch_init, dp->init_cmds, dp->init_syncs, dp->init_bits,
+		       dp->init_us, dp->spi_cmds, dp->spi_syncs);
+}
+
+static DEVICE_ATTR(init_stats, S_IRUGO, hx8369a_init_stats_show, NULL);
+
+static struct attribute *hx8369a_attributes[] = {
+	&dev_attr_init_stats.attr,
+	NULL,
+};
+
+static const struct attribute_group hx8369a_attr_group = {
+	.attrs = hx8369a_attributes,
+};
+
 static void hx8369a_reset(struct hx8369a *dsi_panel)
 {	
 	msleep(120);
@@ -619,6 +912,10 @@ static int hx8369a_dsi_spi_probe(struct spi_device *spi)
 
 	dsi_panel->dev = dev;	
 	dsi_panel->spi = spi;
+
+	// Если контроллер SPI не умеет 9-битные слова, D/C передаётся отдельным байтом
+	dsi_panel->word9 = !!(spi->master->bits_per_word_mask & SPI_BPW_MASK(9));
+	dev_dbg(dev, "SPI word size: %d bits\n", dsi_panel->word9 ? 9 : 8);
 			
 	ret = hx8369a_parse_dt(dsi_panel);
 	if (ret)
@@ -642,6 +939,12 @@ static int hx8369a_dsi_spi_probe(struct spi_device *spi)
 	
 	lcdev->priv = dsi_panel;
 	spi_set_drvdata(spi, lcdev);
+
+	ret = sysfs_create_group(&dev->kobj, &hx8369a_attr_group);
+	if (ret) {
+		dev_err(dev, "sysfs creation hx8369a failed\n");
+		return ret;
+	}
 	
 	//dev_info(&spi->dev, "%s() completed successfully\n", __func__);
 	dev_info(&spi->dev, "HX8369A LCD driver loaded successfully\n");
@@ -651,6 +954,8 @@ static int hx8369a_dsi_spi_probe(struct spi_device *spi)
 
 static int hx8369a_dsi_spi_remove(struct spi_device *spi)
 {
+	sysfs_remove_group(&spi->dev.kobj, &hx8369a_attr_group);
+
 	return 0;
 }
 
@@ -0,0 +1,117 @@
+/* tests/dsi-dphy-timings.c
+ *
+ * Проверка расчёта параметров D-PHY elv_mipi_dsi_calc_dphy_timings() на хосте.
+ * Эталон - исходные формулы из примера "MIPI DSI test" в double: интервалы
+ * в нс, t_byteclk = 4000/ddr_clk_freq нс, UI = 500/ddr_clk_freq нс.
+ * Слагаемые k*t_byteclk и 8 UI переводятся в такты byteclk делением на
+ * t_byteclk, как и все остальные интервалы.
+ *
+ * Сборка и запуск из корня репозитория:
+ *   cc -std=gnu99 -Wall -I tests/host -I tests/host/include \
+ *      -o dsi-dphy-timings tests/dsi-dphy-timings.c -lm && ./dsi-dphy-timings
+ */
+
+#include "../elv-mipi-dsi.c"
+
+/* Погрешность double при делении интервалов, кратных t_byteclk */
+#define REF_EPS		1e-9
+
+static u32 ref_ceil(double x)
+{
+	return x < 0 ? 0 : (u32)ceil(x - REF_EPS);
+}
+
+static u32 ref_round(double x)
+{
+	return x < 0 ? 0 : (u32)floor(x + 0.5 + REF_EPS);
+}
+
+static u32 ref_count(double x, int adj)
+{
+	return (s64)ref_ceil(x) + adj < 0 ? 0 : ref_ceil(x) + adj;
+}
+
+static void ref_dphy_timings(u32 ddr_mhz, u32 margin_pct, struct elv_dsi_timings *t)
+{
+	const double n = 1;
+	const double ui = 500.0 / ddr_mhz;
+	const double tb = 4000.0 / ddr_mhz;
+	const double k = (100.0 + margin_pct) / 100.0;
+	double hs_prep, hs_zero, hs_trail, hs_exit;
+	double clk_prep, clk_zero, clk_trail, clk_exit;
+	double prep;
+
+	hs_prep = 60 + 4 * ui;
+	hs_zero = (170 + 10 * ui - hs_prep) * k;
+	hs_trail = (fmax(n * 8 * ui, 60 + n * 4 * ui) + 30) * k;
+	hs_exit = 115 * k;
+
+	clk_prep = 60;
+	clk_zero = (330 - clk_prep) * k;
+	clk_trail = 60 * k;
+	clk_exit = 60 * k;
+
+	memset(t, 0, sizeof(*t));
+	prep = (double)ref_round(fabs(hs_prep - 18 * ui) / tb) - 1;
+	t->dln_hs_prep = prep < 0 ? 0 : prep;
+	t->dln_hs_zero = ref_count(hs_zero / tb, -1);
+	t->dln_hs_trail = ref_count(hs_trail / tb, -2);
+	t->dln_hs_exit = ref_count(hs_exit / tb, -1);
+
+	t->cln_prep = ref_count(clk_prep / tb, -1);
+	t->cln_zero = ref_count(clk_zero / tb, -1);
+	t->cln_hs_trail = ref_count((clk_trail - 6 * ui) / tb, 3);
+	t->cln_hs_exit = ref_count((clk_exit - 4 * ui) / tb, -1);
+
+	t->lp_byteclk = ref_ceil(ddr_mhz / 48.0);
+	t->high_ls_count = 4 * t->lp_byteclk + t->dln_hs_prep + t->dln_hs_zero +
+			   ref_round(4 * tb / tb);
+	t->hs_to_lp = t->cln_hs_trail + t->cln_hs_exit + ref_round(3 * tb / tb);
+	t->lp_to_hs = 4 * t->lp_byteclk + t->cln_prep + t->cln_zero +
+		      ref_ceil(8 * ui / tb) + ref_round(4 * tb / tb);
+}
+
+#define CHECK_FIELD(f) do { \
+	if (got.f != ref.f) { \
+		fprintf(stderr, "ddr %u MHz, margin %u%%: " #f " %u, expected %u\n", \
+			ddr, margin, got.f, ref.f); \
+		failed++; \
+	} \
+} while (0)
+
+int main(void)
+{
+	static const u32 margins[] = { 0, DSI_LINK_MARGIN_PCT, 2 * DSI_LINK_MARGIN_PCT,
+				       3 * DSI_LINK_MARGIN_PCT };
+	struct elv_dsi_timings got, ref;
+	u32 ddr, margin, i, checked = 0;
+	int failed = 0;
+
+	for (i = 0; i < ARRAY_SIZE(margins); i++) {
+		margin = margins[i];
+		for (ddr = 12 * div_ratio_min; ddr <= DDR_CLK_FREQ_MAX; ddr++) {
+			memset(&got, 0, sizeof(got));
+			got.ddr_mhz = ddr;
+			got.margin_pct = margin;
+			elv_mipi_dsi_calc_dphy_timings(&got);
+			ref_dphy_timings(ddr, margin, &ref);
+
+			CHECK_FIELD(dln_hs_prep);
+			CHECK_FIELD(dln_hs_zero);
+			CHECK_FIELD(dln_hs_trail);
+			CHECK_FIELD(dln_hs_exit);
+			CHECK_FIELD(cln_prep);
+			CHECK_FIELD(cln_zero);
+			CHECK_FIELD(cln_hs_trail);
+			CHECK_FIELD(cln_hs_exit);
+			CHECK_FIELD(lp_byteclk);
+			CHECK_FIELD(high_ls_count);
+			CHECK_FIELD(hs_to_lp);
+			CHECK_FIELD(lp_to_hs);
+			checked++;
+		}
+	}
+
+	printf("dsi-dphy-timings: %u operating points, %d mismatches\n", checked, failed);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,399 @@
+/* tests/dsi-golden.c
+ *
+ * Образ регистров контроллера после последовательностей драйвера на хосте.
+ * Регистры - массив в памяти, regmap и MMIO из tests/host/host-kernel.h.
+ * После каждого сценария массив сравнивается с эталоном для режима по
+ * умолчанию (480x800, rgb888, 2 линии, non-burst, pixclk AXI/(PCLK_DIV+1)).
+ * Эталон рассчитан для значений из tests/host/include/elv-mipi-dsi.h.
+ *
+ * Сборка и запуск из корня репозитория:
+ *   cc -std=gnu99 -Wall -I tests/host -I tests/host/include \
+ *      -o dsi-golden tests/dsi-golden.c -lm && ./dsi-golden
+ */
+
+#include "../elv-mipi-dsi.c"
+
+#define HOST_REGS_SIZE		0x100
+
+struct golden_reg {
+	const char *name;
+	u32 reg;
+	u32 val;
+};
+
+#define GOLDEN(r, v)	{ #r, r, v }
+
+/* Линк запущен в видеорежиме */
+static const struct golden_reg golden_video[] = {
+	GOLDEN(DSI_DEVICE_READY_REG,		0x00000001),
+	GOLDEN(DSI_IRQ_ENABLE_REG,		0xa6ffffff),
+	GOLDEN(DSI_FUNC_PRG_REG,		0x00000202),
+	GOLDEN(DSI_HS_TX_TIMEOUT_REG,		0x00ffffff),
+	GOLDEN(DSI_LP_RX_TIMEOUT_REG,		0x00ffffff),
+	GOLDEN(DSI_TURN_AROUND_TIMEOUT_REG,	0x00001e78),
+	GOLDEN(DSI_DEVICE_RESET_REG,		0x000000ff),
+	GOLDEN(DSI_DPI_RESOLUTION_REG,		0x032001e0),
+	GOLDEN(DSI_HSYNC_COUNT_REG,		0x00000013),
+	GOLDEN(DSI_HORIZ_BACK_PORCH_COUNT_REG,	0x00000013),
+	GOLDEN(DSI_HORIZ_FRONT_PORCH_COUNT_REG,	0x00000013),
+	GOLDEN(DSI_HORIZ_ACTIVE_AREA_COUNT_REG,	0x000002ed),
+	GOLDEN(DSI_VSYNC_COUNT_REG,		0x00000006),
+	GOLDEN(DSI_VERT_BACK_PORCH_COUNT_REG,	0x00000006),
+	GOLDEN(DSI_VERT_FRONT_PORCH_COUNT_REG,	0x00000006),
+	GOLDEN(DSI_HIGH_LOW_SWITCH_COUNT_REG,	0x00000019),
+	GOLDEN(DSI_DPI_CONTROL_REG,		0x00000002),
+	GOLDEN(DSI_PLL_LOCK_COUNT_REG,		0x00000000),
+	GOLDEN(DSI_INIT_COUNT_REG,		0x000007d0),
+	GOLDEN(DSI_MAX_RETURN_PACKET_REG,	0x00000000),
+	GOLDEN(DSI_VIDEO_MODE_FORMAT_REG,	0x00000001),
+	GOLDEN(DSI_CLK_EOT_REG,			0x00000008),
+	GOLDEN(DSI_POLARITY_REG,		0x00000000),
+	GOLDEN(DSI_CLK_LANE_SWT_REG,		0x00210009),
+	GOLDEN(DSI_LP_BYTECLK_REG,		0x00000004),
+	GOLDEN(DSI_DPHY_PARAM_REG,		0x04030500),
+	GOLDEN(DSI_CLK_LANE_TIMING_PARAM_REG,	0x01050a02),
+	GOLDEN(DSI_RST_ENABLE_DFE_REG,		0x00000001),
+	GOLDEN(DSI_TRIM0_REG,			0x00000000),
+	GOLDEN(DSI_TRIM1_REG,			0x00353846),
+	GOLDEN(DSI_TRIM2_REG,			0x00000000),
+	GOLDEN(DSI_TRIM3_REG,			0x00000000),
+	GOLDEN(DSI_AUTO_ERR_REC_REG,		0x00000001),
+	GOLDEN(DSI_DATA_LANE_POLARITY_SWAP_REG,	0x00000000),
+};
+
+/*
+ * Командный режим: видеоформата нет, канал и ширина данных команд в
+ * FUNC_PRG, underrun DPI замаскирован, DPI_CONTROL не пишется
+ */
+static const struct golden_reg golden_cmd_diff[] = {
+	GOLDEN(DSI_IRQ_ENABLE_REG,		0xa6efffff),
+	GOLDEN(DSI_FUNC_PRG_REG,		0x00006002),
+	GOLDEN(DSI_DPI_CONTROL_REG,		0x00000000),
+	GOLDEN(DSI_VIDEO_MODE_FORMAT_REG,	0x00000000),
+};
+
+static struct golden_reg golden_cmd[ARRAY_SIZE(golden_video)];
+
+static u32 host_regs[HOST_REGS_SIZE / 4];
+static struct device host_dev;
+static int failed;
+
+static u32 host_reg(u32 reg)
+{
+	return host_regs[reg / 4];
+}
+
+/* Остановка контроллера и сброс DFE, увиденные на шине */
+static u32 host_ready_off, host_dfe_resets;
+
+static void host_iowrite(u32 val, void __iomem *addr)
+{
+	u32 reg = (u32 *)addr - host_regs;
+
+	if (reg == DSI_DEVICE_READY_REG / 4 && !val)
+		host_ready_off++;
+	if (reg == DSI_RST_ENABLE_DFE_REG / 4)
+		host_dfe_resets++;
+}
+
+static struct elv_mipi_dsi *host_probe(void)
+{
+	struct elv_mipi_dsi_priv *priv = calloc(1, sizeof(*priv));
+	struct elv_mipi_dsi *dsi = &priv->dsi;
+	int ret;
+
+	dsi->dev = &host_dev;
+	dsi->reg_base = host_regs;
+	host_dev.driver_data = dsi;
+	mutex_init(&priv->lock);
+	INIT_DELAYED_WORK(&priv->recover_work, elv_mipi_dsi_recover_work);
+	INIT_DELAYED_WORK(&priv->link_work, elv_mipi_dsi_link_work);
+	init_completion(&priv->read_done);
+
+	ret = elv_mipi_dsi_parse_dt(dsi);
+	if (!ret)
+		ret = elv_mipi_dsi_init_regmap(dsi);
+	if (ret) {
+		fprintf(stderr, "probe: %d\n", ret);
+		exit(1);
+	}
+	BUILD_BUG_ON(DSI_DATA_LANE_POLARITY_SWAP_REG >= HOST_REGS_SIZE);
+	return dsi;
+}
+
+/*
+ * Перепрограммирование под изменённый режим. Новый делитель PLL или
+ * тайминги D-PHY требуют остановки контроллера и сброса DFE, смена
+ * только счётчиков DPI - нет. После перепрограммирования регистры линка
+ * должны совпадать с рассчитанными.
+ */
+static void check_reprogram(const char *scenario, struct elv_mipi_dsi *dsi, bool restart)
+{
+	struct elv_dsi_reg regs[DSI_LINK_REGS_NR];
+	u32 mismatches = 0;
+	int i;
+
+	host_ready_off = host_dfe_resets = 0;
+	host_iowrite_hook = host_iowrite;
+	elv_mipi_dsi_reprogram(dsi);
+	host_iowrite_hook = NULL;
+
+	if (restart != (host_ready_off && host_dfe_resets)) {
+		fprintf(stderr, "%s: %u stops, %u DFE resets, expected %s\n", scenario,
+			host_ready_off, host_dfe_resets, restart ? "restart" : "none");
+		mismatches++;
+	}
+	if ((host_reg(DSI_DEVICE_READY_REG) & DSI_DEVICE_MODE_MASK) != DEVICE_NORMAL_MODE) {
+		fprintf(stderr, "%s: link not in HS\n", scenario);
+		mismatches++;
+	}
+
+	elv_mipi_dsi_link_regs(dsi, regs);
+	for (i = 0; i < DSI_LINK_REGS_NR; i++) {
+		if (host_reg(regs[i].reg) == regs[i].val)
+			continue;
+		fprintf(stderr, "%s: 0x%02x = 0x%08x, expected 0x%08x\n", scenario,
+			regs[i].reg, host_reg(regs[i].reg), regs[i].val);
+		mismatches++;
+	}
+	printf("%-24s%s, %u mismatches\n", scenario, restart ? "restart" : "LP only",
+	       mismatches);
+	failed += mismatches;
+}
+
+static void check_image(const char *scenario, const struct golden_reg *golden, size_t n)
+{
+	u32 mismatches = 0;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		if (host_reg(golden[i].reg) == golden[i].val)
+			continue;
+		fprintf(stderr, "%s: %s = 0x%08x, expected 0x%08x\n", scenario,
+			golden[i].name, host_reg(golden[i].reg), golden[i].val);
+		mismatches++;
+	}
+	printf("%-24s%zu registers, %u mismatches\n", scenario, n, mismatches);
+	failed += mismatches;
+}
+
+/* Как в probe: стоимость init учитывается в seq_cost[DSI_SEQ_INIT] */
+static bool host_init(struct elv_mipi_dsi *dsi)
+{
+	struct elv_mipi_dsi_priv *priv = to_dsi_priv(dsi);
+	struct elv_dsi_cost cost = dsi_seq_start(priv);
+	bool handoff;
+
+	handoff = elv_mipi_dsi_init_dsi(dsi);
+	dsi_seq_end(priv, DSI_SEQ_INIT, cost);
+	return handoff;
+}
+
+/* Запись в sysfs ulp_mode */
+static void host_ulp_mode(const char *val)
+{
+	elv_mipi_dsi_ulp_mode_store(&host_dev, NULL, val, strlen(val));
+}
+
+/* Обращения к шине последней последовательности DSI_SEQ_* */
+static void print_cost(struct elv_mipi_dsi *dsi, int seq)
+{
+	struct elv_dsi_cost *cost = &to_dsi_priv(dsi)->seq_cost[seq];
+
+	printf("  %-22s%u reads, %u writes\n", elv_dsi_seq_names[seq],
+	       cost->reads, cost->writes);
+}
+
+/* Фатальная ошибка линка из прерывания */
+static void host_fatal_irq(struct elv_mipi_dsi *dsi)
+{
+	u32 irq = DSI_INT_FATAL & elv_mipi_dsi_irq_mask(to_dsi_priv(dsi));
+
+	host_regs[DSI_IRQ_STATUS_REG / 4] = irq & -irq;
+	dsi_irq_handler(0, dsi);
+	host_regs[DSI_IRQ_STATUS_REG / 4] = 0;
+}
+
+int main(void)
+{
+	struct elv_mipi_dsi_priv *priv;
+	struct elv_mipi_dsi *dsi;
+	size_t i, j;
+	u32 writes, ratio, level, restores;
+
+	/* Холодный старт: регистры после сброса */
+	dsi = host_probe();
+	priv = to_dsi_priv(dsi);
+	if (host_init(dsi)) {
+		fprintf(stderr, "init: unexpected handoff from reset state\n");
+		failed++;
+	}
+	check_image("init", golden_video, ARRAY_SIZE(golden_video));
+	print_cost(dsi, DSI_SEQ_INIT);
+
+	/* Вход в ULPS и выход из него через sysfs не меняют конфигурацию */
+	host_ulp_mode("1");
+	host_ulp_mode("0");
+	check_image("ulps enter/exit", golden_video, ARRAY_SIZE(golden_video));
+	print_cost(dsi, DSI_SEQ_ULPS_ENTER);
+	print_cost(dsi, DSI_SEQ_ULPS_EXIT);
+
+	/*
+	 * Перепрограммирование без изменений режима: только вход в LP и выход
+	 * (три записи DEVICE_READY), без выключения контроллера и сброса DFE
+	 */
+	writes = atomic_read(&priv->mmio_writes);
+	elv_mipi_dsi_reprogram(dsi);
+	check_image("reprogram", golden_video, ARRAY_SIZE(golden_video));
+	writes = atomic_read(&priv->mmio_writes) - writes;
+	printf("%-24s%u\n", "reprogram writes", writes);
+	if (writes != 3) {
+		fprintf(stderr, "reprogram: %u writes, expected 3\n", writes);
+		failed++;
+	}
+
+	/* Частота кадров в пределах шага PLL: меняются только счётчики DPI */
+	priv->vm.pixelclock = 25500000;
+	check_reprogram("reprogram dpi", dsi, false);
+	print_cost(dsi, DSI_SEQ_REPROGRAM);
+
+	/* Частота кадров со сменой делителя PLL */
+	priv->vm.pixelclock = 30000000;
+	check_reprogram("reprogram rate", dsi, true);
+	print_cost(dsi, DSI_SEQ_REPROGRAM);
+
+	/* Уровень запаса линка: тайминги D-PHY длиннее */
+	priv->vm.pixelclock = 0;
+	priv->link_level = 1;
+	check_reprogram("reprogram level", dsi, true);
+
+	priv->link_level = 0;
+	elv_mipi_dsi_reprogram(dsi);
+	check_image("reprogram back", golden_video, ARRAY_SIZE(golden_video));
+
+	/* Ручной ULPS переживает перепрограммирование, в том числе с перезапуском */
+	host_ulp_mode("1");
+	for (level = 0; level < 3; level++) {
+		priv->link_level = level & 1;
+		elv_mipi_dsi_reprogram(dsi);
+		if (!dsi->ulp_mode ||
+		    (host_reg(DSI_DEVICE_READY_REG) & DSI_DEVICE_MODE_MASK) != DEVICE_ULP_MODE) {
+			fprintf(stderr, "reprogram: manual ULPS left at level %u\n", level & 1);
+			failed++;
+		}
+	}
+	host_ulp_mode("0");
+	check_image("manual ULPS reprogram", golden_video, ARRAY_SIZE(golden_video));
+
+	/*
+	 * Фатальная ошибка: линк перезапускается из работы восстановления.
+	 * Повтор внутри DSI_RECOVER_INTERVAL_MS откладывается до конца
+	 * интервала, ошибка при ожидающем восстановлении с ним сливается.
+	 */
+	host_fatal_irq(dsi);
+	host_run_works();
+	host_fatal_irq(dsi);
+	host_run_works();
+	host_fatal_irq(dsi);
+	if (priv->recoveries != 1 || priv->recover_skipped != 1) {
+		fprintf(stderr, "recover: %u recoveries, %u merged inside the interval, expected 1, 1\n",
+			priv->recoveries, priv->recover_skipped);
+		failed++;
+	}
+	jiffies += msecs_to_jiffies(DSI_RECOVER_INTERVAL_MS);
+	host_run_works();
+	if (priv->recoveries != 2) {
+		fprintf(stderr, "recover: deferred recovery did not run\n");
+		failed++;
+	}
+	check_image("recover", golden_video, ARRAY_SIZE(golden_video));
+
+	/* Системный suspend/resume без снятия питания */
+	dsi_dev_suspend(&host_dev);
+	dsi_dev_resume(&host_dev);
+	check_image("suspend/resume", golden_video, ARRAY_SIZE(golden_video));
+
+	/* Снятие питания домена: регистры сброшены, resume восстанавливает их */
+	restores = priv->ctx_restores;
+	dsi_dev_suspend(&host_dev);
+	memset(host_regs, 0, sizeof(host_regs));
+	dsi_dev_resume(&host_dev);
+	if (priv->ctx_restores != restores + 1) {
+		fprintf(stderr, "restore: power loss not detected\n");
+		failed++;
+	}
+	check_image("context restore", golden_video, ARRAY_SIZE(golden_video));
+	print_cost(dsi, DSI_SEQ_RESTORE);
+
+	/* Повторный probe над работающим линком принимает его без записей */
+	dsi = host_probe();
+	priv = to_dsi_priv(dsi);
+	if (!host_init(dsi)) {
+		fprintf(stderr, "handoff: running link not adopted\n");
+		failed++;
+	}
+	check_image("handoff", golden_video, ARRAY_SIZE(golden_video));
+	print_cost(dsi, DSI_SEQ_INIT);
+	if (priv->seq_cost[DSI_SEQ_INIT].writes) {
+		fprintf(stderr, "handoff: %u writes, expected 0\n",
+			priv->seq_cost[DSI_SEQ_INIT].writes);
+		failed++;
+	}
+
+	/* Загрузчик с другими таймингами D-PHY: линк настраивается заново */
+	host_regs[DSI_CLK_LANE_SWT_REG / 4] ^= 1;
+	dsi = host_probe();
+	if (host_init(dsi)) {
+		fprintf(stderr, "stale handoff: mismatching link adopted\n");
+		failed++;
+	}
+	check_image("stale handoff", golden_video, ARRAY_SIZE(golden_video));
+	print_cost(dsi, DSI_SEQ_INIT);
+
+	/* Совпавшие с загрузчиком регистры init на шину не пишет */
+	writes = atomic_read(&to_dsi_priv(dsi)->writes_skipped);
+	printf("  %-22s%u\n", "init skipped", writes);
+	if (!writes) {
+		fprintf(stderr, "stale handoff: unchanged registers rewritten\n");
+		failed++;
+	}
+
+	/* Командный режим с холодного старта */
+	memcpy(golden_cmd, golden_video, sizeof(golden_video));
+	for (i = 0; i < ARRAY_SIZE(golden_cmd); i++)
+		for (j = 0; j < ARRAY_SIZE(golden_cmd_diff); j++)
+			if (golden_cmd[i].reg == golden_cmd_diff[j].reg)
+				golden_cmd[i].val = golden_cmd_diff[j].val;
+	memset(host_regs, 0, sizeof(host_regs));
+	dsi = host_probe();
+	to_dsi_priv(dsi)->cmd_mode = true;
+	host_init(dsi);
+	check_image("command mode", golden_cmd, ARRAY_SIZE(golden_cmd));
+
+	/*
+	 * Уровни запаса в burst-режиме: частота линка снижается на шаг PLL
+	 * за уровень, интервалы D-PHY удлиняются
+	 */
+	dsi = host_probe();
+	priv = to_dsi_priv(dsi);
+	priv->burst_mode = true;
+	elv_mipi_dsi_calc_link(dsi);
+	ratio = priv->timings.div_ratio;
+	for (level = 1; level < DSI_LINK_LEVELS; level++) {
+		struct elv_dsi_timings *t = &priv->timings;
+
+		priv->link_level = level;
+		elv_mipi_dsi_calc_link(dsi);
+		if (t->div_ratio != ratio - level ||
+		    t->margin_pct != level * DSI_LINK_MARGIN_PCT) {
+			fprintf(stderr, "link level %u: div_ratio %u, margin %u%%, expected %u, %u%%\n",
+				level, t->div_ratio, t->margin_pct, ratio - level,
+				level * DSI_LINK_MARGIN_PCT);
+			failed++;
+		}
+	}
+	printf("%-24s%u levels, ddr_clk %u..%u MHz\n", "link levels", DSI_LINK_LEVELS,
+	       priv->timings.ddr_mhz, ratio * 12);
+
+	return failed ? 1 : 0;
+}
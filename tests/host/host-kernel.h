@@ -0,0 +1,701 @@
+/* tests/host/host-kernel.h
+ *
+ * Подмножество API ядра для сборки elv-mipi-dsi.c на хосте.
+ *
+ * Регистры контроллера - обычный массив в памяти: ioread32/iowrite32
+ * работают с ним напрямую, а regmap повторяет поведение плоского кэша
+ * ядра (cache_only, отложенная запись, regcache_sync только при грязном
+ * кэше, в cache_only на шину не выходит ни одна запись). Работы ставятся
+ * в очередь и выполняются тестом через host_run_works(), jiffies тест
+ * двигает сам. Остальное - заглушки без побочных эффектов: блокировки
+ * пустые, runtime PM считает устройство активным.
+ */
+
+#ifndef _HOST_KERNEL_H
+#define _HOST_KERNEL_H
+
+/* Конфигурация ядра платформы: runtime PM есть, debugfs на хосте нет */
+#define CONFIG_PM	1
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef unsigned long long u64;
+typedef int32_t s32;
+typedef long long s64;
+typedef unsigned int gfp_t;
+typedef unsigned short umode_t;
+typedef s64 ktime_t;
+typedef int irqreturn_t;
+typedef irqreturn_t (*irq_handler_t)(int, void *);
+typedef unsigned long resource_size_t;
+
+#define __iomem
+#define __user
+#define __init
+#define __exit
+#define __maybe_unused		__attribute__((unused))
+
+#define EPROBE_DEFER		517
+#define ERESTARTSYS		512
+
+#define BIT(n)			(1UL << (n))
+#define GENMASK(h, l)		(((~0U) << (l)) & (~0U >> (31 - (h))))
+#define ARRAY_SIZE(a)		(sizeof(a) / sizeof((a)[0]))
+#define BUILD_BUG_ON(c)		((void)sizeof(char[1 - 2 * !!(c)]))
+#define container_of(p, t, m)	((t *)((char *)(p) - offsetof(t, m)))
+#define min(a, b)		((a) < (b) ? (a) : (b))
+#define max(a, b)		((a) > (b) ? (a) : (b))
+#define min_t(t, a, b)		min((t)(a), (t)(b))
+#define max_t(t, a, b)		max((t)(a), (t)(b))
+#define DIV_ROUND_UP(n, d)	(((n) + (d) - 1) / (d))
+#define DIV_ROUND_UP_ULL(n, d)	DIV_ROUND_UP((u64)(n), (d))
+#define DIV_ROUND_CLOSEST(x, d)	(((x) + (d) / 2) / (d))
+#define rounddown(x, y)		((x) - ((x) % (y)))
+#define READ_ONCE(x)		(x)
+#define WRITE_ONCE(x, v)	((x) = (v))
+#define IS_ERR(p)		((unsigned long)(p) >= (unsigned long)-4095)
+#define IS_ERR_VALUE(x)		((unsigned long)(x) >= (unsigned long)-4095)
+#define PTR_ERR(p)		((long)(p))
+#define ERR_PTR(e)		((void *)(long)(e))
+#define likely(x)		(x)
+#define unlikely(x)		(x)
+
+/* Однопоточный тест: atomic_t - обычный счётчик */
+typedef struct { int counter; } atomic_t;
+
+static inline int atomic_read(const atomic_t *v) { return v->counter; }
+static inline void atomic_set(atomic_t *v, int i) { v->counter = i; }
+static inline void atomic_inc(atomic_t *v) { v->counter++; }
+
+#define for_each_set_bit(bit, addr, size) \
+	for ((bit) = 0; (bit) < (size); (bit)++) \
+		if (*(addr) & (1UL << (bit)))
+
+static inline s64 abs64(s64 x) { return x < 0 ? -x : x; }
+static inline s64 div_s64(s64 x, s32 d) { return x / d; }
+static inline u64 div_u64(u64 x, u32 d) { return x / d; }
+static inline u64 div64_u64(u64 x, u64 d) { return x / d; }
+static inline int ilog2(u64 x) { return 63 - __builtin_clzll(x); }
+
+/* Модуль и печать */
+struct module;
+#define THIS_MODULE			((struct module *)0)
+#define MODULE_LICENSE(x)
+#define MODULE_AUTHOR(x)
+#define MODULE_DESCRIPTION(x)
+#define MODULE_DEVICE_TABLE(t, n)
+#define MODULE_PARM_DESC(n, d)
+#define EXPORT_SYMBOL_GPL(s)
+#define module_param_named(n, v, t, p)
+#define module_platform_driver(d)	static struct platform_driver *__host_##d __maybe_unused = &d
+#define of_match_ptr(p)			(p)
+
+#define dev_err(d, ...)		((void)(d), fprintf(stderr, __VA_ARGS__))
+#define dev_warn(d, ...)	((void)(d), fprintf(stderr, __VA_ARGS__))
+#define dev_info(d, ...)	((void)(d), (void)sizeof(printf(__VA_ARGS__)))
+#define dev_dbg(d, ...)		((void)(d), (void)sizeof(printf(__VA_ARGS__)))
+
+static inline char *strim(char *s)
+{
+	char *e;
+
+	while (*s == ' ' || *s == '\t' || *s == '\n')
+		s++;
+	e = s + strlen(s);
+	while (e > s && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\n'))
+		*--e = '\0';
+	return s;
+}
+
+static inline int sysfs_streq(const char *a, const char *b)
+{
+	size_t n = strlen(a);
+
+	if (n && a[n - 1] == '\n')
+		n--;
+	return strlen(b) == n && !strncmp(a, b, n);
+}
+
+static inline int kstrtol(const char *s, unsigned int base, long *res)
+{
+	char *end;
+
+	errno = 0;
+	*res = strtol(s, &end, base);
+	if (errno || end == s || (*end && *end != '\n'))
+		return -EINVAL;
+	return 0;
+}
+
+static inline int kstrtou32(const char *s, unsigned int base, u32 *res)
+{
+	long v;
+
+	if (kstrtol(s, base, &v) || v < 0 || v > UINT32_MAX)
+		return -EINVAL;
+	*res = v;
+	return 0;
+}
+
+static inline int scnprintf(char *buf, size_t size, const char *fmt, ...)
+{
+	va_list args;
+	int n;
+
+	if (!size)
+		return 0;
+	va_start(args, fmt);
+	n = vsnprintf(buf, size, fmt, args);
+	va_end(args);
+	return n < (int)size ? n : (int)size - 1;
+}
+
+/* Память */
+#define GFP_KERNEL		0
+static inline void *kzalloc(size_t size, gfp_t gfp) { return calloc(1, size); }
+static inline void *kcalloc(size_t n, size_t size, gfp_t gfp) { return calloc(n, size); }
+static inline void kfree(const void *p) { free((void *)p); }
+static inline char *kstrndup(const char *s, size_t n, gfp_t gfp) { return strndup(s, n); }
+
+/* Время: jiffies двигает тест, ожидания мгновенные */
+#define HZ			100
+static unsigned long jiffies __maybe_unused;
+#define time_before(a, b)	((long)((a) - (b)) < 0)
+static inline unsigned long msecs_to_jiffies(unsigned int ms) { return DIV_ROUND_UP(ms * HZ, 1000); }
+static inline void usleep_range(unsigned long min, unsigned long max) { }
+
+static inline ktime_t ktime_get(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (s64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+static inline s64 ktime_to_ns(ktime_t t) { return t; }
+static inline s64 ktime_us_delta(ktime_t a, ktime_t b) { return (a - b) / 1000; }
+
+/*
+ * MMIO: reg_base указывает на массив регистров теста. Тест может
+ * наблюдать за каждой записью на шину через host_iowrite_hook, а через
+ * host_ioread_hook - менять регистр перед чтением, как это делала бы
+ * аппаратура.
+ */
+static void (*host_iowrite_hook)(u32 val, void __iomem *addr);
+static void (*host_ioread_hook)(const void __iomem *addr);
+
+static inline u32 ioread32(const void __iomem *addr)
+{
+	if (host_ioread_hook)
+		host_ioread_hook(addr);
+	return *(const volatile u32 *)addr;
+}
+static inline void iowrite32(u32 val, void __iomem *addr)
+{
+	*(volatile u32 *)addr = val;
+	if (host_iowrite_hook)
+		host_iowrite_hook(val, addr);
+}
+#define readl(addr)		ioread32(addr)
+
+/*
+ * Опрос, как в ядре: чтение через каждые sleep_us (минимум 1 мкс
+ * модельного времени) до выполнения условия или истечения timeout_us,
+ * после таймаута - последнее чтение
+ */
+#define readl_poll_timeout(addr, val, cond, sleep_us, timeout_us) \
+({ \
+	unsigned long __left = (timeout_us); \
+	unsigned long __step = (sleep_us) ? (sleep_us) : 1; \
+	int __ret; \
+	for (;;) { \
+		(val) = readl(addr); \
+		if (cond) { \
+			__ret = 0; \
+			break; \
+		} \
+		if (!__left) { \
+			(val) = readl(addr); \
+			__ret = (cond) ? 0 : -ETIMEDOUT; \
+			break; \
+		} \
+		__left -= __left < __step ? __left : __step; \
+	} \
+	__ret; \
+})
+#define readl_poll_timeout_atomic	readl_poll_timeout
+
+/* Синхронизация */
+struct mutex { int unused; };
+typedef struct { int unused; } spinlock_t;
+typedef struct { int unused; } wait_queue_head_t;
+struct completion { unsigned int done; };
+static inline void mutex_init(struct mutex *m) { }
+static inline void mutex_lock(struct mutex *m) { }
+static inline void mutex_unlock(struct mutex *m) { }
+static inline void spin_lock_init(spinlock_t *l) { }
+#define spin_lock_irqsave(l, f)		((void)(l), (f) = 0)
+#define spin_unlock_irqrestore(l, f)	((void)(l), (void)(f))
+static inline void init_waitqueue_head(wait_queue_head_t *q) { }
+static inline void wake_up_all(wait_queue_head_t *q) { }
+#define wait_event_interruptible_timeout(q, cond, t)	((cond) ? 1L : 0L)
+static inline void init_completion(struct completion *c) { c->done = 0; }
+static inline void reinit_completion(struct completion *c) { c->done = 0; }
+static inline void complete(struct completion *c) { c->done++; }
+static inline unsigned long wait_for_completion_timeout(struct completion *c, unsigned long t)
+{
+	if (!c->done)
+		return 0;
+	c->done--;
+	return t ? t : 1;
+}
+
+/*
+ * Работы: очередь без потоков. host_run_works() выполняет все работы,
+ * срок которых по jiffies наступил, в том числе поставленные заново
+ * из самих работ.
+ */
+struct work_struct {
+	void (*func)(struct work_struct *);
+	bool pending;
+	unsigned long expires;
+};
+struct delayed_work { struct work_struct work; };
+struct workqueue_struct;
+#define system_wq		((struct workqueue_struct *)0)
+#define INIT_WORK(w, f)		((w)->func = (f), (w)->pending = false)
+#define INIT_DELAYED_WORK(w, f)	INIT_WORK(&(w)->work, f)
+#define to_delayed_work(w)	container_of(w, struct delayed_work, work)
+
+#define HOST_WORKS_MAX		16
+static struct work_struct *host_works[HOST_WORKS_MAX];
+
+static inline bool host_queue_work(struct work_struct *w, unsigned long delay, bool mod)
+{
+	int i;
+
+	if (w->pending) {
+		if (mod)
+			w->expires = jiffies + delay;
+		return false;
+	}
+	for (i = 0; i < HOST_WORKS_MAX; i++) {
+		if (host_works[i])
+			continue;
+		host_works[i] = w;
+		w->pending = true;
+		w->expires = jiffies + delay;
+		return true;
+	}
+	fprintf(stderr, "host: work queue full\n");
+	abort();
+}
+
+static inline bool host_cancel_work(struct work_struct *w)
+{
+	bool pending = w->pending;
+	int i;
+
+	for (i = 0; i < HOST_WORKS_MAX; i++)
+		if (host_works[i] == w)
+			host_works[i] = NULL;
+	w->pending = false;
+	return pending;
+}
+
+/* Возвращает число выполненных работ */
+static inline unsigned int host_run_works(void)
+{
+	unsigned int runs = 0;
+	bool ran;
+	int i;
+
+	do {
+		ran = false;
+		for (i = 0; i < HOST_WORKS_MAX; i++) {
+			struct work_struct *w = host_works[i];
+
+			if (!w || time_before(jiffies, w->expires))
+				continue;
+			host_works[i] = NULL;
+			w->pending = false;
+			w->func(w);
+			ran = true;
+			runs++;
+		}
+	} while (ran);
+	return runs;
+}
+
+static inline bool schedule_work(struct work_struct *w) { return host_queue_work(w, 0, false); }
+static inline bool schedule_delayed_work(struct delayed_work *w, unsigned long d)
+{
+	return host_queue_work(&w->work, d, false);
+}
+static inline bool mod_delayed_work(struct workqueue_struct *q, struct delayed_work *w,
+				    unsigned long d)
+{
+	return !host_queue_work(&w->work, d, true);
+}
+static inline bool cancel_work_sync(struct work_struct *w) { return host_cancel_work(w); }
+static inline bool cancel_delayed_work_sync(struct delayed_work *w)
+{
+	return host_cancel_work(&w->work);
+}
+
+/* Модель устройств */
+struct device_node;
+struct kernfs_node;
+struct kobject { struct kernfs_node *sd; };
+struct device {
+	struct device_node *of_node;
+	void *driver_data;
+	struct kobject kobj;
+};
+
+static inline void *dev_get_drvdata(const struct device *dev) { return dev->driver_data; }
+static inline const char *dev_name(const struct device *dev) { return "elv-mipi-dsi"; }
+static inline void *devm_kzalloc(struct device *dev, size_t size, gfp_t gfp) { return calloc(1, size); }
+static inline int devm_add_action(struct device *dev, void (*action)(void *), void *data) { return 0; }
+
+struct attribute { const char *name; umode_t mode; };
+struct device_attribute {
+	struct attribute attr;
+	ssize_t (*show)(struct device *, struct device_attribute *, char *);
+	ssize_t (*store)(struct device *, struct device_attribute *, const char *, size_t);
+};
+#define S_IRUGO			0444
+#define S_IWUSR			0200
+#define DEVICE_ATTR(n, m, s, st) \
+	struct device_attribute dev_attr_##n = { { #n, m }, s, st }
+struct attribute_group { const char *name; struct attribute **attrs; };
+static inline int sysfs_create_group(struct kobject *k, const struct attribute_group *g) { return 0; }
+static inline void sysfs_remove_group(struct kobject *k, const struct attribute_group *g) { }
+static inline struct kernfs_node *sysfs_get_dirent(struct kernfs_node *p, const char *n) { return NULL; }
+static inline void sysfs_put(struct kernfs_node *kn) { }
+static inline void sysfs_notify_dirent(struct kernfs_node *kn) { }
+
+struct resource { resource_size_t start, end; };
+#define IORESOURCE_MEM		0x200
+struct platform_device { struct device dev; };
+struct of_device_id { const char *compatible; const void *data; };
+struct dev_pm_ops {
+	int (*suspend)(struct device *);
+	int (*resume)(struct device *);
+	int (*freeze)(struct device *);
+	int (*runtime_suspend)(struct device *);
+	int (*runtime_resume)(struct device *);
+	int (*runtime_idle)(struct device *);
+};
+#define SET_RUNTIME_PM_OPS(s, r, i) \
+	.runtime_suspend = s, .runtime_resume = r, .runtime_idle = i,
+struct device_driver {
+	const char *name;
+	const struct of_device_id *of_match_table;
+	const struct dev_pm_ops *pm;
+	bool suppress_bind_attrs;
+};
+struct platform_driver {
+	int (*probe)(struct platform_device *);
+	int (*remove)(struct platform_device *);
+	struct device_driver driver;
+};
+static inline void *platform_get_drvdata(const struct platform_device *p) { return p->dev.driver_data; }
+static inline void platform_set_drvdata(struct platform_device *p, void *d) { p->dev.driver_data = d; }
+static inline struct resource *platform_get_resource(struct platform_device *p, unsigned int t,
+						     unsigned int n) { return NULL; }
+static inline int platform_get_irq(struct platform_device *p, unsigned int n) { return -ENXIO; }
+static inline void __iomem *devm_ioremap_resource(struct device *d, struct resource *r)
+{
+	return ERR_PTR(-EINVAL);
+}
+static inline int devm_request_irq(struct device *d, unsigned int irq, irq_handler_t h,
+				   unsigned long f, const char *n, void *id) { return 0; }
+static inline void disable_irq(unsigned int irq) { }
+#define IRQ_NONE		0
+#define IRQ_HANDLED		1
+#define IRQF_TRIGGER_RISING	1
+
+/* DT без свойств: драйвер берёт значения по умолчанию */
+static inline bool of_property_read_bool(const struct device_node *np, const char *n) { return false; }
+static inline int of_property_read_u32(const struct device_node *np, const char *n, u32 *v) { return -EINVAL; }
+static inline int of_property_read_string(const struct device_node *np, const char *n,
+					  const char **s) { return -EINVAL; }
+static inline int of_property_count_u32_elems(const struct device_node *np, const char *n) { return -EINVAL; }
+static inline struct device_node *of_get_child_by_name(const struct device_node *np,
+						       const char *n) { return NULL; }
+static inline void of_node_put(struct device_node *np) { }
+static inline struct device_node *of_parse_phandle(const struct device_node *np, const char *n,
+						   int i) { return NULL; }
+struct spi_device;
+static inline struct spi_device *of_find_spi_device_by_node(struct device_node *np) { return NULL; }
+
+/* Клоки и GPIO */
+struct clk;
+static inline struct clk *devm_clk_get(struct device *d, const char *id) { return ERR_PTR(-ENOENT); }
+static inline void clk_put(struct clk *c) { }
+static inline int clk_prepare_enable(struct clk *c) { return 0; }
+static inline void clk_disable(struct clk *c) { }
+static inline void clk_disable_unprepare(struct clk *c) { }
+static inline int clk_set_rate(struct clk *c, unsigned long rate) { return -EINVAL; }
+static inline unsigned long clk_get_rate(struct clk *c) { return 0; }
+struct gpio_desc;
+enum gpiod_flags { GPIOD_IN = 1 };
+static inline struct gpio_desc *devm_gpiod_get_optional(struct device *d, const char *id,
+							enum gpiod_flags f) { return NULL; }
+static inline int gpiod_to_irq(const struct gpio_desc *g) { return -ENXIO; }
+
+/* Runtime PM: устройство всегда активно */
+static inline int pm_runtime_get(struct device *d) { return 0; }
+static inline int pm_runtime_get_sync(struct device *d) { return 0; }
+static inline void pm_runtime_get_noresume(struct device *d) { }
+static inline int pm_runtime_put_autosuspend(struct device *d) { return 0; }
+static inline void pm_runtime_put_noidle(struct device *d) { }
+static inline void pm_runtime_mark_last_busy(struct device *d) { }
+static inline int pm_runtime_set_active(struct device *d) { return 0; }
+static inline void pm_runtime_enable(struct device *d) { }
+static inline void pm_runtime_disable(struct device *d) { }
+static inline void pm_runtime_use_autosuspend(struct device *d) { }
+static inline void pm_runtime_dont_use_autosuspend(struct device *d) { }
+static inline void pm_runtime_set_autosuspend_delay(struct device *d, int ms) { }
+static inline bool pm_runtime_suspended(struct device *d) { return false; }
+static inline bool pm_runtime_status_suspended(struct device *d) { return false; }
+
+/* Режимы дисплея */
+struct videomode {
+	unsigned long pixelclock;
+	u32 hactive, hfront_porch, hback_porch, hsync_len;
+	u32 vactive, vfront_porch, vback_porch, vsync_len;
+	int flags;
+};
+struct display_timings { unsigned int num_timings; unsigned int native_mode; };
+static inline struct display_timings *of_get_display_timings(struct device_node *np) { return NULL; }
+static inline void display_timings_release(struct display_timings *disp) { }
+static inline int videomode_from_timings(const struct display_timings *disp,
+					 struct videomode *vm, unsigned int index) { return -EINVAL; }
+
+/* mipi_dsi_host: пакеты собираются как в drm_mipi_dsi.c */
+struct mipi_dsi_host;
+struct mipi_dsi_device { char name[20]; unsigned int channel; unsigned int lanes; };
+struct mipi_dsi_msg {
+	u8 channel;
+	u8 type;
+	u16 flags;
+	size_t tx_len;
+	const void *tx_buf;
+	size_t rx_len;
+	void *rx_buf;
+};
+struct mipi_dsi_packet { size_t size; u8 header[4]; size_t payload_length; const u8 *payload; };
+struct mipi_dsi_host_ops {
+	int (*attach)(struct mipi_dsi_host *, struct mipi_dsi_device *);
+	int (*detach)(struct mipi_dsi_host *, struct mipi_dsi_device *);
+	ssize_t (*transfer)(struct mipi_dsi_host *, const struct mipi_dsi_msg *);
+};
+struct mipi_dsi_host { struct device *dev; const struct mipi_dsi_host_ops *ops; };
+#define MIPI_DSI_MSG_USE_LPM		BIT(0)
+#define MIPI_DSI_DCS_SHORT_WRITE	0x05
+#define MIPI_DSI_DCS_SHORT_WRITE_PARAM	0x15
+#define MIPI_DSI_DCS_LONG_WRITE		0x39
+#define MIPI_DCS_SET_COLUMN_ADDRESS	0x2a
+#define MIPI_DCS_SET_PAGE_ADDRESS	0x2b
+#define MIPI_DCS_WRITE_MEMORY_START	0x2c
+#define MIPI_DCS_SET_TEAR_ON		0x35
+#define MIPI_DCS_WRITE_MEMORY_CONTINUE	0x3c
+#define MIPI_DCS_SET_PIXEL_FORMAT	0x3a
+#define MIPI_DCS_PIXEL_FMT_24BIT	7
+#define MIPI_DCS_PIXEL_FMT_18BIT	6
+#define MIPI_DCS_PIXEL_FMT_16BIT	5
+
+static inline int mipi_dsi_create_packet(struct mipi_dsi_packet *packet,
+					 const struct mipi_dsi_msg *msg)
+{
+	const u8 *tx = msg->tx_buf;
+
+	memset(packet, 0, sizeof(*packet));
+	packet->header[0] = ((msg->channel & 0x3) << 6) | (msg->type & 0x3f);
+	if (msg->type == MIPI_DSI_DCS_LONG_WRITE) {
+		packet->header[1] = msg->tx_len & 0xff;
+		packet->header[2] = msg->tx_len >> 8;
+		packet->payload_length = msg->tx_len;
+		packet->payload = tx;
+	} else {
+		packet->header[1] = msg->tx_len > 0 ? tx[0] : 0;
+		packet->header[2] = msg->tx_len > 1 ? tx[1] : 0;
+	}
+	packet->size = 4 + packet->payload_length;
+	return 0;
+}
+static inline int mipi_dsi_host_register(struct mipi_dsi_host *host) { return 0; }
+static inline void mipi_dsi_host_unregister(struct mipi_dsi_host *host) { }
+
+/* Трассировка выключена */
+#define TP_PROTO(...)		__VA_ARGS__
+#define TP_ARGS(...)		__VA_ARGS__
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print) \
+	static inline void trace_##name(proto) { } \
+	static inline bool trace_##name##_enabled(void) { return false; }
+
+/*
+ * regmap с плоским кэшем. Как и в ядре: в режиме cache_only запись
+ * попадает только в кэш и помечает его грязным, regcache_sync() пишет
+ * все кэшируемые регистры по возрастанию адреса и только если кэш
+ * грязный. Вне cache_only volatile регистры всегда идут на шину.
+ */
+enum regcache_type { REGCACHE_NONE, REGCACHE_FLAT };
+struct regmap_config {
+	int reg_bits;
+	int val_bits;
+	int reg_stride;
+	bool fast_io;
+	bool (*readable_reg)(struct device *, unsigned int);
+	bool (*writeable_reg)(struct device *, unsigned int);
+	bool (*volatile_reg)(struct device *, unsigned int);
+	bool (*precious_reg)(struct device *, unsigned int);
+	int (*reg_read)(void *, unsigned int, unsigned int *);
+	int (*reg_write)(void *, unsigned int, unsigned int);
+	unsigned int max_register;
+	enum regcache_type cache_type;
+};
+
+struct regmap {
+	struct regmap_config config;
+	struct device *dev;
+	void *context;
+	bool cache_only;
+	bool cache_dirty;
+	unsigned int *cache;
+	bool *cache_valid;
+};
+
+static inline bool regmap_host_cached(struct regmap *map, unsigned int reg)
+{
+	return !map->config.volatile_reg || !map->config.volatile_reg(map->dev, reg);
+}
+
+static inline struct regmap *devm_regmap_init(struct device *dev, const void *bus, void *context,
+					      const struct regmap_config *config)
+{
+	unsigned int n = config->max_register / config->reg_stride + 1;
+	struct regmap *map = calloc(1, sizeof(*map));
+
+	map->config = *config;
+	map->dev = dev;
+	map->context = context;
+	map->cache = calloc(n, sizeof(*map->cache));
+	map->cache_valid = calloc(n, sizeof(*map->cache_valid));
+	return map;
+}
+
+static inline int regmap_read(struct regmap *map, unsigned int reg, unsigned int *val)
+{
+	unsigned int i = reg / map->config.reg_stride;
+	int ret;
+
+	if (regmap_host_cached(map, reg) && map->cache_valid[i]) {
+		*val = map->cache[i];
+		return 0;
+	}
+	if (map->cache_only)
+		return -EBUSY;
+	ret = map->config.reg_read(map->context, reg, val);
+	if (!ret && regmap_host_cached(map, reg)) {
+		map->cache[i] = *val;
+		map->cache_valid[i] = true;
+	}
+	return ret;
+}
+
+static inline int regmap_write(struct regmap *map, unsigned int reg, unsigned int val)
+{
+	unsigned int i = reg / map->config.reg_stride;
+
+	if (reg > map->config.max_register)
+		return -EIO;
+	/*
+	 * Как _regmap_write() в 4.4: regcache_write() пропускает volatile
+	 * регистр, но в cache_only запись на шину не выходит ни для какого
+	 * регистра, volatile запись просто теряется
+	 */
+	if (regmap_host_cached(map, reg)) {
+		map->cache[i] = val;
+		map->cache_valid[i] = true;
+	}
+	if (map->cache_only) {
+		map->cache_dirty = true;
+		return 0;
+	}
+	return map->config.reg_write(map->context, reg, val);
+}
+
+static inline int regmap_update_bits_check(struct regmap *map, unsigned int reg,
+					   unsigned int mask, unsigned int val, bool *change)
+{
+	unsigned int orig, tmp;
+	int ret;
+
+	if (change)
+		*change = false;
+	ret = regmap_read(map, reg, &orig);
+	if (ret)
+		return ret;
+	tmp = (orig & ~mask) | (val & mask);
+	if (tmp == orig)
+		return 0;
+	if (change)
+		*change = true;
+	return regmap_write(map, reg, tmp);
+}
+
+static inline int regmap_update_bits(struct regmap *map, unsigned int reg,
+				     unsigned int mask, unsigned int val)
+{
+	return regmap_update_bits_check(map, reg, mask, val, NULL);
+}
+
+static inline void regcache_cache_only(struct regmap *map, bool enable)
+{
+	map->cache_only = enable;
+}
+
+static inline void regcache_mark_dirty(struct regmap *map)
+{
+	map->cache_dirty = true;
+}
+
+static inline int regcache_sync(struct regmap *map)
+{
+	unsigned int reg;
+	int ret;
+
+	if (!map->cache_dirty)
+		return 0;
+	for (reg = 0; reg <= map->config.max_register; reg += map->config.reg_stride) {
+		unsigned int i = reg / map->config.reg_stride;
+
+		if (!map->cache_valid[i] || !regmap_host_cached(map, reg))
+			continue;
+		if (map->config.writeable_reg && !map->config.writeable_reg(map->dev, reg))
+			continue;
+		ret = map->config.reg_write(map->context, reg, map->cache[i]);
+		if (ret)
+			return ret;
+	}
+	map->cache_dirty = false;
+	return 0;
+}
+
+#endif /* _HOST_KERNEL_H */
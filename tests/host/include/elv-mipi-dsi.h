@@ -0,0 +1,80 @@
+/* tests/host/include/elv-mipi-dsi.h
+ *
+ * Имена регистров и битов контроллера, которые использует драйвер, для
+ * сборки на хосте. Заголовок ядра (vpoutfb/elv-mipi-dsi.h) в этот
+ * репозиторий не входит. Тесты сравнивают регистры по именам, поэтому
+ * от адресов здесь требуется только, чтобы они были разными и лежали
+ * в порядке карты контроллера. Частоты и пределы PLL заданы для теста,
+ * эталонные значения в tests/ рассчитаны именно для них. При изменении
+ * заголовка ядра этот список нужно дополнить.
+ */
+
+#ifndef _HOST_ELV_MIPI_DSI_H
+#define _HOST_ELV_MIPI_DSI_H
+
+/* Регистры */
+#define DSI_DEVICE_READY_REG			0x00
+#define DSI_IRQ_STATUS_REG			0x04
+#define DSI_IRQ_ENABLE_REG			0x08
+#define DSI_FUNC_PRG_REG			0x0c
+#define DSI_HS_TX_TIMEOUT_REG			0x10
+#define DSI_LP_RX_TIMEOUT_REG			0x14
+#define DSI_TURN_AROUND_TIMEOUT_REG		0x18
+#define DSI_DEVICE_RESET_REG			0x1c
+#define DSI_DPI_RESOLUTION_REG			0x20
+#define DSI_HSYNC_COUNT_REG			0x28
+#define DSI_HORIZ_BACK_PORCH_COUNT_REG		0x2c
+#define DSI_HORIZ_FRONT_PORCH_COUNT_REG		0x30
+#define DSI_HORIZ_ACTIVE_AREA_COUNT_REG		0x34
+#define DSI_VSYNC_COUNT_REG			0x38
+#define DSI_VERT_BACK_PORCH_COUNT_REG		0x3c
+#define DSI_VERT_FRONT_PORCH_COUNT_REG		0x40
+#define DSI_HIGH_LOW_SWITCH_COUNT_REG		0x44
+#define DSI_DPI_CONTROL_REG			0x48
+#define DSI_PLL_LOCK_COUNT_REG			0x4c
+#define DSI_INIT_COUNT_REG			0x50
+#define DSI_MAX_RETURN_PACKET_REG		0x54
+#define DSI_VIDEO_MODE_FORMAT_REG		0x58
+#define DSI_CLK_EOT_REG				0x5c
+#define DSI_POLARITY_REG			0x60
+#define DSI_CLK_LANE_SWT_REG			0x64
+#define DSI_LP_BYTECLK_REG			0x68
+#define DSI_DPHY_PARAM_REG			0x90
+#define DSI_CLK_LANE_TIMING_PARAM_REG		0x94
+#define DSI_RST_ENABLE_DFE_REG			0x98
+#define DSI_TRIM0_REG				0xa0
+#define DSI_TRIM1_REG				0xa4
+#define DSI_TRIM2_REG				0xa8
+#define DSI_TRIM3_REG				0xac
+#define DSI_AUTO_ERR_REC_REG			0xb0
+#define DSI_DIR_DPI_DIFF_REG			0xb4
+#define DSI_DATA_LANE_POLARITY_SWAP_REG		0xb8
+
+/* Поля регистров и параметры */
+#define DEVICE_ENABLE				BIT(0)
+#define DEVICE_ULP_MODE				(2 << 1)
+#define DEVICE_EXIT_MODE			(1 << 1)
+#define DEVICE_NORMAL_MODE			0
+#define DFE_RST_ENABLE				1
+#define TURN_OFF_PERIPHERAL			BIT(0)
+#define TURN_ON_PERIPHERAL			BIT(1)
+#define DISABLE_VIDEO_BTA			BIT(3)
+#define ENABLE_VIDEO_BTA			0
+#define ECC_MUL_ERR_CLR				BIT(0)
+#define INT_OUTFIFO				BIT(31)
+#define BURST_MODE				3
+#define NON_BURST_WITH_SYNC_PULSES		1
+#define AXI_CLK_MHZ				100
+#define PCLK_DIV				3
+#define DDR_CLK_FREQ_MAX			1000
+#define div_ratio_min				1
+#define div_ratio_max				80
+#define HSYNC_bpc_min				1
+#define HSYNC_fpc_min				1
+#define DATA_LANES_2				2
+#define RGB888					(4 << 7)
+#define VM_CHAN_NO_0				0
+#define VSYNC_bpc_min				1
+#define VSYNC_fpc_min				1
+
+#endif /* _HOST_ELV_MIPI_DSI_H */
@@ -0,0 +1 @@
+#include "host-kernel.h"
@@ -0,0 +1,64 @@
+/* tests/host/include/video/elv_mipi_dsi.h
+ *
+ * Общие структуры драйверов vpoutfb и MIPI DSI в объёме, нужном для
+ * сборки elv-mipi-dsi.c на хосте. Заголовок ядра в репозиторий не входит.
+ */
+
+#ifndef _HOST_VIDEO_ELV_MIPI_DSI_H
+#define _HOST_VIDEO_ELV_MIPI_DSI_H
+
+#include "host-kernel.h"
+
+enum {
+	DSI_video_format_RGB565,
+	DSI_video_format_RGB666,
+	DSI_video_format_RGB666_lp,
+	DSI_video_format_RGB888,
+};
+
+enum {
+	DSI_vd_mode_non_burst_sync_pulse,
+	DSI_vd_mode_non_burst_sync_events,
+	DSI_vd_mode_burst,
+};
+
+enum {
+	DSI_virt_ch_0,
+};
+
+enum {
+	DSI_DataLanes_1 = 1,
+	DSI_DataLanes_2,
+};
+
+struct mipi_dsi_config {
+	int data_lanes;
+	int video_format;
+	int ch_video_mode;
+	int video_mode;
+	u32 pclk_freq;
+	u32 t_pclk;
+	u32 t_byteclk;
+	u32 ddr_freq;
+	u32 DPI_resolution_h;
+	u32 DPI_resolution_v;
+	u32 HSYNC_aac;
+	u32 HSYNC_bpc;
+	u32 HSYNC_count;
+	u32 HSYNC_fpc;
+	u32 VSYNC_bpc;
+	u32 VSYNC_count;
+	u32 VSYNC_fpc;
+};
+
+struct elv_mipi_dsi {
+	struct device *dev;
+	void __iomem *reg_base;
+	int irq;
+	struct clk *dphy_clk;
+	unsigned long ulp_mode;
+	struct mipi_dsi_config dsi_config;
+	struct dentry *debugfs;
+};
+
+#endif /* _HOST_VIDEO_ELV_MIPI_DSI_H */